@@ -2,11 +2,70 @@
 #define DECODER_H
 
 #include "transfer.h"
+#include "gf_simd.h"
+
+/* rs_syndromes_buf() of a codeword whose symbols are stride symbols apart,
+   see rs_encode_strided().                                             */
+static inline int rs_syndromes_strided(const rs_codec_t * rs, const MSG_TYPE * data, int len, int stride,
+                                       const MSG_TYPE * bb, unsigned char * s)
+{
+    register int i ;
+    unsigned char any = 0 ;
+
+    gf_active()->syndromes(rs, data, len, stride, bb, s) ;
+    for (i=0; i<rs->np; i++)
+        any |= s[i] ;
+
+    return any != 0 ;
+}
+
+/* Compute the np syndromes of a received word with codec rs, s[i-1] = s_i for
+   i=1..np, directly in polynomial form and without copying the word. The
+   word is given by its parity bb[0..np-1] and its len data symbols, see
+   rs_encode_buf(). Returns nonzero if any syndrome is nonzero, i.e. if the
+   word is corrupted.                                                   */
+static inline int rs_syndromes_buf(const rs_codec_t * rs, const MSG_TYPE * data, int len, const MSG_TYPE * bb,
+                                   unsigned char * s)
+{
+    return rs_syndromes_strided(rs, data, len, 1, bb, s) ;
+}
+
+/* rs_syndromes_buf() of the (shortened) codeword of a packet, of F_length =
+   packet->header[3] data symbols; rs must have nn-kk parity symbols. A frame
+   length over kk is reported as a corrupted packet, without syndromes.  */
+static inline int rs_syndromes(const rs_codec_t * rs, const packet_t * packet, unsigned char * s)
+{
+    if (packet->header[3] > kk)
+        return 1 ;
+
+    return rs_syndromes_buf(rs, packet->data, packet->header[3], packet->ECF, s) ;
+}
+
+/* Fast check for the common, error-free case: returns 1 if the packet is a
+   valid codeword, in which case there is nothing for rs_decode() to do.  */
+static inline int rs_check(const rs_codec_t * rs, const packet_t * packet)
+{
+    unsigned char s[RS_MAX_ROOTS] ;
+
+    return !rs_syndromes(rs, packet, s) ;
+}
+
+/* Received symbol i of the codeword in a packet, in polynomial form:
+   recd[i] = ECF[i] for i=0..(nn-kk-1) and data[i-(nn-kk)] for i=nn-kk..(nn-1).
+   The decoders read and correct the packet in place through this, instead of
+   through a global buffer, so that packets can be decoded concurrently.  */
+static inline MSG_TYPE * recd_rs(packet_t * packet, int i)
+{
+    return (i < nn-kk) ? &(packet->ECF[i]) : &(packet->data[i-(nn-kk)]) ;
+}
 
 /* Assume we have received bits grouped into mm-bit symbols in recd[i],
-   i=0..(nn-1),  and recd[i] is index form (ie as powers of alpha).
+   i=0..(nn-1),  and recd[i] is polynomial form (see recd_rs()).
    We first compute the 2*tt syndromes by substituting alpha**i into rec(X) and
    evaluating, storing the syndromes in s[i], i=1..2tt (leave s[0] zero) .
+   The syndromes are evaluated here with the tables only, not with the
+   gf_simd kernels, so that the reference stays independent of the code it
+   checks; if they are all zero the packet is returned right away.
    Then we use the Berlekamp iteration to find the error location polynomial
    elp[i].   If the degree of the elp is >tt, we cannot correct all the errors
    and hence just put out the information symbols uncorrected. If the degree of
@@ -20,34 +79,50 @@
    advantage of systematic encoding is that hopefully some of the information
    symbols will be okay and that if we are in luck, the errors are in the
    parity part of the transmitted codeword).  Of course, these insoluble cases
-   can be returned as error flags to the calling routine if desired.   */
-void decode_rs(packet_t * packet)
+   can be returned as error flags to the calling routine if desired.
+   Returns the number of corrected symbols, or -1 if the errors could not be
+   corrected. If status is not NULL the details are stored in it (see
+   decode_status_t in transfer.h).
+   This is the original decoder, kept as a reference; it is only valid for
+   the default code, RS_PARAMS_DEFAULT, and always decodes all kk data
+   symbols, so short frames must be zero padded. rs_decode() handles any
+   code and shortened frames.                                           */
+static inline int decode_rs_ref(const rs_codec_t * rs, packet_t * packet, decode_status_t * status)
 {
-    transfer_t transfer;
     register int i,j,u,q ;
+    decode_status_t st ;
+    const unsigned char * alpha_to = rs->alpha_to ;
+    const short * index_of = rs->index_of ;
 
-    for (i=0; i<nn-kk; i++)     recd[i]         = packet->ECF[i] ;
-    for (i=0; i<kk; i++)        recd[i+nn-kk]   = packet->data[i] ;
+    if (status == NULL)  status = &st ;
+    status->success  = 0 ;
+    status->syn_zero = 0 ;
+    status->count    = 0 ;
 
-    for (i=0; i<nn; i++)
-        recd[i] = index_of[recd[i]] ;          /* put recd[i] into index form */
+    if (!rs_params_equal(&(rs->par), &rs_default_params))
+        return -1 ;
 
     int elp[nn-kk+2][nn-kk], d[nn-kk+2], l[nn-kk+2], u_lu[nn-kk+2], s[nn-kk+1] ;
-    int count=0, syn_error=0, root[tt], loc[tt], z[tt+1], err[nn], reg[tt+1] ;
+    int count=0, root[tt], loc[tt], z[tt+1], err[nn], reg[tt+1], syn_error=0 ;
 
 /* first form the syndromes */
     for (i=1; i<=nn-kk; i++)
     { s[i] = 0 ;
         for (j=0; j<nn; j++)
-            if (recd[j]!=-1)
-                s[i] ^= alpha_to[(recd[j]+i*j)%nn] ;      /* recd[j] in index form */
+            if (*recd_rs(packet, j)!=0)
+                s[i] ^= alpha_to[(index_of[*recd_rs(packet, j)]+i*j)%nn] ;   /* recd[j] in index form */
 /* convert syndrome from polynomial form to index form  */
         if (s[i]!=0)  syn_error=1 ;        /* set flag if non-zero syndrome => error */
         s[i] = index_of[s[i]] ;
     } ;
 
-    if (syn_error)       /* if errors, try and correct */
-    {
+    if (!syn_error)
+    {   /* no non-zero syndromes => no errors: leave received codeword as is */
+        status->success  = 1 ;
+        status->syn_zero = 1 ;
+        return 0 ;
+    }
+
 /* compute the error location polynomial via the Berlekamp iterative algorithm,
    following the terminology of Lin and Costello :   d[u] is the 'mu'th
    discrepancy, where u='mu'+1 and 'mu' (the Greek letter!) is the step number
@@ -56,161 +131,718 @@ void decode_rs(packet_t * packet)
    step number and the degree of the elp.
 */
 /* initialise table entries */
-        d[0] = 0 ;           /* index form */
-        d[1] = s[1] ;        /* index form */
-        elp[0][0] = 0 ;      /* index form */
-        elp[1][0] = 1 ;      /* polynomial form */
-        for (i=1; i<nn-kk; i++)
-        { elp[0][i] = -1 ;   /* index form */
-            elp[1][i] = 0 ;   /* polynomial form */
-        }
-        l[0] = 0 ;
-        l[1] = 0 ;
-        u_lu[0] = -1 ;
-        u_lu[1] = 0 ;
-        u = 0 ;
-
-        do
-        {
-            u++ ;
-            if (d[u]==-1)
-            { l[u+1] = l[u] ;
-                for (i=0; i<=l[u]; i++)
-                {  elp[u+1][i] = elp[u][i] ;
-                    elp[u][i] = index_of[elp[u][i]] ;
-                }
+    d[0] = 0 ;           /* index form */
+    d[1] = s[1] ;        /* index form */
+    elp[0][0] = 0 ;      /* index form */
+    elp[1][0] = 1 ;      /* polynomial form */
+    for (i=1; i<nn-kk; i++)
+    { elp[0][i] = -1 ;   /* index form */
+        elp[1][i] = 0 ;   /* polynomial form */
+    }
+    l[0] = 0 ;
+    l[1] = 0 ;
+    u_lu[0] = -1 ;
+    u_lu[1] = 0 ;
+    u = 0 ;
+
+    do
+    {
+        u++ ;
+        if (d[u]==-1)
+        { l[u+1] = l[u] ;
+            for (i=0; i<=l[u]; i++)
+            {  elp[u+1][i] = elp[u][i] ;
+                elp[u][i] = index_of[elp[u][i]] ;
             }
-            else
+        }
+        else
 /* search for words with greatest u_lu[q] for which d[q]!=0 */
-            { q = u-1 ;
-                while ((d[q]==-1) && (q>0)) q-- ;
+        { q = u-1 ;
+            while ((d[q]==-1) && (q>0)) q-- ;
 /* have found first non-zero d[q]  */
-                if (q>0)
-                { j=q ;
-                    do
-                    { j-- ;
-                        if ((d[j]!=-1) && (u_lu[q]<u_lu[j]))
-                            q = j ;
-                    }while (j>0) ;
-                } ;
+            if (q>0)
+            { j=q ;
+                do
+                { j-- ;
+                    if ((d[j]!=-1) && (u_lu[q]<u_lu[j]))
+                        q = j ;
+                }while (j>0) ;
+            } ;
 
 /* have now found q such that d[u]!=0 and u_lu[q] is maximum */
 /* store degree of new elp polynomial */
-                if (l[u]>l[q]+u-q)  l[u+1] = l[u] ;
-                else  l[u+1] = l[q]+u-q ;
+            if (l[u]>l[q]+u-q)  l[u+1] = l[u] ;
+            else  l[u+1] = l[q]+u-q ;
 
 /* form new elp(x) */
-                for (i=0; i<nn-kk; i++)    elp[u+1][i] = 0 ;
-                for (i=0; i<=l[q]; i++)
-                    if (elp[q][i]!=-1)
-                        elp[u+1][i+u-q] = alpha_to[(d[u]+nn-d[q]+elp[q][i])%nn] ;
-                for (i=0; i<=l[u]; i++)
-                { elp[u+1][i] ^= elp[u][i] ;
-                    elp[u][i] = index_of[elp[u][i]] ;  /*convert old elp value to index*/
-                }
+            for (i=0; i<nn-kk; i++)    elp[u+1][i] = 0 ;
+            for (i=0; i<=l[q]; i++)
+                if (elp[q][i]!=-1)
+                    elp[u+1][i+u-q] = alpha_to[(d[u]+nn-d[q]+elp[q][i])%nn] ;
+            for (i=0; i<=l[u]; i++)
+            { elp[u+1][i] ^= elp[u][i] ;
+                elp[u][i] = index_of[elp[u][i]] ;  /*convert old elp value to index*/
             }
-            u_lu[u+1] = u-l[u+1] ;
+        }
+        u_lu[u+1] = u-l[u+1] ;
 
 /* form (u+1)th discrepancy */
-            if (u<nn-kk)    /* no discrepancy computed on last iteration */
-            {
-                if (s[u+1]!=-1)
-                    d[u+1] = alpha_to[s[u+1]] ;
-                else
-                    d[u+1] = 0 ;
-                for (i=1; i<=l[u+1]; i++)
-                    if ((s[u+1-i]!=-1) && (elp[u+1][i]!=0))
-                        d[u+1] ^= alpha_to[(s[u+1-i]+index_of[elp[u+1][i]])%nn] ;
-                d[u+1] = index_of[d[u+1]] ;    /* put d[u+1] into index form */
-            }
-        } while ((u<nn-kk) && (l[u+1]<=tt)) ;
-
-        u++ ;
-        if (l[u]<=tt)         /* can correct error */
+        if (u<nn-kk)    /* no discrepancy computed on last iteration */
         {
+            if (s[u+1]!=-1)
+                d[u+1] = alpha_to[s[u+1]] ;
+            else
+                d[u+1] = 0 ;
+            for (i=1; i<=l[u+1]; i++)
+                if ((s[u+1-i]!=-1) && (elp[u+1][i]!=0))
+                    d[u+1] ^= alpha_to[(s[u+1-i]+index_of[elp[u+1][i]])%nn] ;
+            d[u+1] = index_of[d[u+1]] ;    /* put d[u+1] into index form */
+        }
+    } while ((u<nn-kk) && (l[u+1]<=tt)) ;
+
+    u++ ;
+    if (l[u]<=tt)         /* can correct error */
+    {
 /* put elp into index form */
-            for (i=0; i<=l[u]; i++)   elp[u][i] = index_of[elp[u][i]] ;
+        for (i=0; i<=l[u]; i++)   elp[u][i] = index_of[elp[u][i]] ;
 
 /* find roots of the error location polynomial */
-            for (i=1; i<=l[u]; i++)
-                reg[i] = elp[u][i] ;
-            count = 0 ;
-            for (i=1; i<=nn; i++)
-            {  q = 1 ;
-                for (j=1; j<=l[u]; j++)
-                    if (reg[j]!=-1)
-                    { reg[j] = (reg[j]+j)%nn ;
-                        q ^= alpha_to[reg[j]] ;
-                    } ;
-                if (!q)        /* store root and error location number indices */
-                { root[count] = i;
-                    loc[count] = nn-i ;
-                    count++ ;
-                };
-            } ;
-            if (count==l[u])    /* no. roots = degree of elp hence <= tt errors */
-            {
-/* form polynomial z(x) */
-                for (i=1; i<=l[u]; i++)        /* Z[0] = 1 always - do not need */
-                { if ((s[i]!=-1) && (elp[u][i]!=-1))
-                        z[i] = alpha_to[s[i]] ^ alpha_to[elp[u][i]] ;
-                    else if ((s[i]!=-1) && (elp[u][i]==-1))
-                        z[i] = alpha_to[s[i]] ;
-                    else if ((s[i]==-1) && (elp[u][i]!=-1))
-                        z[i] = alpha_to[elp[u][i]] ;
-                    else
-                        z[i] = 0 ;
-                    for (j=1; j<i; j++)
-                        if ((s[j]!=-1) && (elp[u][i-j]!=-1))
-                            z[i] ^= alpha_to[(elp[u][i-j] + s[j])%nn] ;
-                    z[i] = index_of[z[i]] ;         /* put into index form */
+        for (i=1; i<=l[u]; i++)
+            reg[i] = elp[u][i] ;
+        count = 0 ;
+        for (i=1; i<=nn; i++)
+        {  q = 1 ;
+            for (j=1; j<=l[u]; j++)
+                if (reg[j]!=-1)
+                { reg[j] = (reg[j]+j)%nn ;
+                    q ^= alpha_to[reg[j]] ;
                 } ;
+            if (!q)        /* store root and error location number indices */
+            { root[count] = i;
+                loc[count] = nn-i ;
+                count++ ;
+            };
+        } ;
+        if (count==l[u])    /* no. roots = degree of elp hence <= tt errors */
+        {
+/* form polynomial z(x) */
+            for (i=1; i<=l[u]; i++)        /* Z[0] = 1 always - do not need */
+            { if ((s[i]!=-1) && (elp[u][i]!=-1))
+                    z[i] = alpha_to[s[i]] ^ alpha_to[elp[u][i]] ;
+                else if ((s[i]!=-1) && (elp[u][i]==-1))
+                    z[i] = alpha_to[s[i]] ;
+                else if ((s[i]==-1) && (elp[u][i]!=-1))
+                    z[i] = alpha_to[elp[u][i]] ;
+                else
+                    z[i] = 0 ;
+                for (j=1; j<i; j++)
+                    if ((s[j]!=-1) && (elp[u][i-j]!=-1))
+                        z[i] ^= alpha_to[(elp[u][i-j] + s[j])%nn] ;
+                z[i] = index_of[z[i]] ;         /* put into index form */
+            } ;
 
-                /* evaluate errors at locations given by error location numbers loc[i] */
-                for (i=0; i<nn; i++)
-                { err[i] = 0 ;
-                    if (recd[i]!=-1)        /* convert recd[] to polynomial form */
-                        recd[i] = alpha_to[recd[i]] ;
-                    else  recd[i] = 0 ;
-                }
-                for (i=0; i<l[u]; i++)    /* compute numerator of error term first */
-                { err[loc[i]] = 1;       /* accounts for z[0] */
-                    for (j=1; j<=l[u]; j++)
-                        if (z[j]!=-1)
-                            err[loc[i]] ^= alpha_to[(z[j]+j*root[i])%nn] ;
-                    if (err[loc[i]]!=0)
-                    { err[loc[i]] = index_of[err[loc[i]]] ;
-                        q = 0 ;     /* form denominator of error term */
-                        for (j=0; j<l[u]; j++)
-                            if (j!=i)
-                                q += index_of[1^alpha_to[(loc[j]+root[i])%nn]] ;
-                        q = q % nn ;
-                        err[loc[i]] = alpha_to[(err[loc[i]]-q+nn)%nn] ;
-                        recd[loc[i]] ^= err[loc[i]] ;  /*recd[i] must be in polynomial form */
-                    }
+            /* evaluate errors at locations given by error location numbers loc[i] */
+            for (i=0; i<nn; i++)
+                err[i] = 0 ;
+            for (i=0; i<l[u]; i++)    /* compute numerator of error term first */
+            { err[loc[i]] = 1;       /* accounts for z[0] */
+                for (j=1; j<=l[u]; j++)
+                    if (z[j]!=-1)
+                        err[loc[i]] ^= alpha_to[(z[j]+j*root[i])%nn] ;
+                if (err[loc[i]]!=0)
+                { err[loc[i]] = index_of[err[loc[i]]] ;
+                    q = 0 ;     /* form denominator of error term */
+                    for (j=0; j<l[u]; j++)
+                        if (j!=i)
+                            q += index_of[1^alpha_to[(loc[j]+root[i])%nn]] ;
+                    q = q % nn ;
+                    err[loc[i]] = alpha_to[(err[loc[i]]-q+nn)%nn] ;
+                    *recd_rs(packet, loc[i]) ^= err[loc[i]] ;  /*recd[i] must be in polynomial form */
+                    status->loc[status->count] = loc[i] ;
+                    status->mag[status->count] = (MSG_TYPE) err[loc[i]] ;
+                    status->count++ ;
                 }
             }
-            else    /* no. roots != degree of elp => >tt errors and cannot solve */
-                for (i=0; i<nn; i++)        /* could return error flag if desired */
-                    if (recd[i]!=-1)        /* convert recd[] to polynomial form */
-                        recd[i] = alpha_to[recd[i]] ;
-                    else  recd[i] = 0 ;     /* just output received codeword as is */
-        }
-        else         /* elp has degree has degree >tt hence cannot solve */
-            for (i=0; i<nn; i++)       /* could return error flag if desired */
-                if (recd[i]!=-1)        /* convert recd[] to polynomial form */
-                    recd[i] = alpha_to[recd[i]] ;
-                else  recd[i] = 0 ;     /* just output received codeword as is */
-    }
-    else       /* no non-zero syndromes => no errors: output received codeword */
-        for (i=0; i<nn; i++)
-            if (recd[i]!=-1)        /* convert recd[] to polynomial form */
-                recd[i] = alpha_to[recd[i]] ;
-            else  recd[i] = 0 ;
-
-    for (i=0; i<nn-kk; i++) packet->ECF[i]    = recd[i];
-    for (i=0; i<kk; i++)    packet->data[i]   = recd[i+nn-kk];
+            status->success = 1 ;
+        }
+        /* else no. roots != degree of elp => >tt errors and cannot solve:
+           the packet is output as is and the error flag is returned */
+    }
+    /* else elp has degree has degree >tt hence cannot solve: the packet is
+       output as is and the error flag is returned */
+
+    if (!status->success)
+    {   status->count = 0 ;
+        return -1 ;
+    }
+
+    return status->count ;
+}
+
+/* Errors-and-erasures decoder for any code (see rs_params_t). The received
+   word is given by its parity bb[0..np-1] and its len <= k data symbols, as
+   for rs_encode_buf(), and is corrected in place. The positions of no_eras
+   symbols known to be unreliable (e.g. flagged by the demodulator) are passed
+   in eras_pos[], as codeword positions: 0..np-1 for bb[] and np..np+len-1 for
+   data[]. Any combination of e errors and no_eras distinct erasures with
+   2*e + no_eras <= np is corrected.
+
+   The syndromes are s_i = r(alpha**(prim*(fcr+i-1))), i=1..np, so that an
+   errata at position p has the locator X = alpha**(prim*p). The
+   Berlekamp-Massey algorithm is started with the erasure locator polynomial,
+   lambda(X) = prod (1 + X*X_i), instead of 1, and iterates over the remaining
+   np-no_eras syndromes only (Blahut, "Theory and practice of error control
+   codes"). It is run in its inversionless form on a few byte-sized
+   polynomials, so the working state of the decoder is under 1 kB. The roots of the resulting errata locator are found directly for a
+   single errata and by a Chien search otherwise, and the errata values follow
+   from Forney's algorithm,
+        e_j = X_j**(1-fcr) * omega(X_j**-1) / lambda'(X_j**-1),
+        omega(X) = s(X)*lambda(X) mod X**np,  s(X) = s_1 + s_2*X + ...
+   Returns the number of corrected symbols, or -1 if the errata could not be
+   corrected, in which case the word is left as received. If status is not
+   NULL the details are stored in it (see decode_status_t in transfer.h).
+   rs_decode_np() takes q = rs->q and np = rs->np as arguments so that the
+   loop bounds and reductions modulo q are constants when it is called with
+   constants (see RS_FIXED_DECODER), and decodes codewords whose symbols are
+   stride symbols apart (see rs_encode_strided()); rs_decode_buf() is the
+   general version.                                                        */
+static RS_INLINE int rs_decode_np(const rs_codec_t * rs, const int q, const int np, MSG_TYPE * data, int len,
+                                  int stride, MSG_TYPE * bb, const int * eras_pos, int no_eras,
+                                  decode_status_t * status)
+{
+    register int i,j,r ;
+    decode_status_t st ;
+    const unsigned char * alpha_to = rs->alpha_to ;
+    const short * index_of = rs->index_of ;
+    unsigned char syn[RS_MAX_ROOTS], lambda[RS_MAX_ROOTS+1], b[RS_MAX_ROOTS+1], omega[RS_MAX_ROOTS] ;
+    unsigned char root[RS_MAX_ROOTS], loc[RS_MAX_ROOTS], reg[RS_MAX_ROOTS], step[RS_MAX_ROOTS] ;
+    int p, k, r2, el, terms, discr_r, gamma, deg_lambda, deg_omega, count, num, den, tmp ;
+
+    if (status == NULL)  status = &st ;
+    status->success  = 0 ;
+    status->syn_zero = 0 ;
+    status->count    = 0 ;
+
+    if (len < 0 || len > rs->par.k || stride < 1)
+        return -1 ;
+    if (no_eras < 0 || no_eras > np)
+        return -1 ;
+    for (i=0; i<no_eras; i++)
+        if (eras_pos[i] < 0 || eras_pos[i] >= np+len)
+            return -1 ;
+
+/* form the syndromes, s_i = syn[i-1]; all zero => no errors and the erased
+   symbols are correct. The stages are timed with RS_PROF_LAP(), which is
+   empty unless RS_PROFILE is defined (see profile.h).                      */
+    RS_PROF_START(t) ;
+    r = rs_syndromes_strided(rs, data, len, stride, bb, syn) ;
+    RS_PROF_LAP(RS_STAGE_SYNDROMES, t) ;
+    if (!r)
+    {   status->success  = 1 ;
+        status->syn_zero = 1 ;
+        RS_PROF_ERRATA(0) ;
+        return 0 ;
+    }
+
+/* initialise lambda(X) to the erasure locator polynomial. From here on all
+   polynomials are in polynomial form and products are taken from the
+   split-nibble tables (gf_mul()), so there are no conversions between index
+   and polynomial form and no reductions modulo q.                         */
+    lambda[0] = 1 ;
+    for (i=1; i<=np; i++)   lambda[i] = 0 ;
+    for (i=0; i<no_eras; i++)
+    {   tmp = alpha_to[(rs->par.prim*eras_pos[i]) % q] ;
+        for (j=i+1; j>0; j--)
+            lambda[j] ^= gf_mul(rs, tmp, lambda[j-1]) ;
+    }
+    for (i=0; i<=np; i++)   b[i] = lambda[i] ;
+
+/* inversionless Berlekamp-Massey over the syndromes s[no_eras+1..np]: lambda(X)
+   is the current errata locator, b(X) the correction polynomial, gamma the
+   discrepancy at which b(X) was last taken from lambda(X) and el the current
+   number of errata. Instead of dividing b(X) by the discrepancy, lambda(X) is
+   scaled by gamma, so lambda(X) is only known up to a constant factor, which
+   is divided out once at the end. lambda(X) is updated in place: from the top
+   down, lambda[i] only depends on b[i-1] and on its own old value.        */
+    gamma = 1 ;
+    el    = no_eras ;
+    for (r=no_eras+1; r<=np; r++)
+    {
+        discr_r = 0 ;       /* r-th discrepancy; deg lambda(X) <= el */
+        for (i=(el < r-1) ? el : r-1; i>=0; i--)
+            discr_r ^= gf_mul(rs, lambda[i], syn[r-1-i]) ;
+
+        if (discr_r == 0)
+        {   /* b(X) <- X*b(X) */
+            for (i=np; i>0; i--)   b[i] = b[i-1] ;
+            b[0] = 0 ;
+        }
+        else if (2*el <= r+no_eras-1)
+        {   /* lambda(X) <- gamma*lambda(X) - discr_r*X*b(X), b(X) <- old lambda(X) */
+            el = r+no_eras-el ;
+            for (i=np; i>0; i--)
+            {   tmp       = lambda[i] ;
+                lambda[i] = gf_mul(rs, gamma, tmp) ^ gf_mul(rs, discr_r, b[i-1]) ;
+                b[i]      = tmp ;
+            }
+            b[0]      = lambda[0] ;
+            lambda[0] = gf_mul(rs, gamma, lambda[0]) ;
+            gamma     = discr_r ;
+        }
+        else
+        {   /* lambda(X) <- gamma*lambda(X) - discr_r*X*b(X), b(X) <- X*b(X) */
+            for (i=np; i>0; i--)
+            {   lambda[i] = gf_mul(rs, gamma, lambda[i]) ^ gf_mul(rs, discr_r, b[i-1]) ;
+                b[i]      = b[i-1] ;
+            }
+            lambda[0] = gf_mul(rs, gamma, lambda[0]) ;
+            b[0]      = 0 ;
+        }
+    }
+
+/* scale lambda(X) to lambda_0 = 1 and find its degree */
+    tmp = (q - index_of[lambda[0]]) % q ;   /* lambda_0**-1, index form */
+    deg_lambda = 0 ;
+    for (i=0; i<=np; i++)
+        if (lambda[i] != 0)
+        {   lambda[i]  = gf_mul(rs, alpha_to[tmp], lambda[i]) ;
+            deg_lambda = i ;
+        }
+
+/* lambda(X) is only the errata locator if its degree is el, the length of
+   the shortest register that generates the syndromes, and e errors and
+   no_eras erasures take 2*e + no_eras <= np; otherwise it may even have all
+   its roots without the errata being corrected                            */
+    RS_PROF_LAP(RS_STAGE_LOCATOR, t) ;
+    if (deg_lambda != el || 2*el > np+no_eras)
+    {   RS_PROF_ERRATA(-1) ;
+        return -1 ;
+    }
+
+/* find the roots of the errata locator polynomial, X_p**-1 = alpha**(-prim*p)
+   for an errata at position p. A single errata is found directly: lambda(X) =
+   1 + lambda_1*X, so X_p = lambda_1 and p = lambda_1/prim (index form).
+   Otherwise lambda(X) is evaluated at X_p**-1 by a Chien search over the np+len
+   positions p of the (shortened) codeword only, stepping each nonzero term
+   reg[j] = lambda_i*X_p**-i (index form) by -prim*i per position. The search
+   stops as soon as deg_lambda roots have been found, or when too few
+   positions are left. A root at a virtual (zero padding) position is not
+   found, so that the errata are then uncorrectable as the number of roots
+   falls short.                                                            */
+    count = 0 ;
+    if (deg_lambda == 1)
+    {   tmp = index_of[lambda[1]] ;
+        p   = (tmp*rs->iprim) % q ;
+        if (p < np+len)
+        {   root[0] = (unsigned char) ((q-tmp) % q) ;
+            loc[0]  = (unsigned char) p ;
+            count   = 1 ;
+        }
+    }
+    else
+    {   for (i=1, terms=0; i<=deg_lambda; i++)
+            if (lambda[i] != 0)
+            {   reg[terms]  = (unsigned char) index_of[lambda[i]] ;
+                step[terms] = (unsigned char) ((i*(q-rs->par.prim)) % q) ;
+                terms++ ;
+            }
+        for (p=0; count<deg_lambda && np+len-p >= deg_lambda-count; p++)
+        {   tmp = 1 ;           /* lambda_0 = 1 */
+            for (j=0; j<terms; j++)
+            {   tmp ^= alpha_to[reg[j]] ;
+                k = reg[j]+step[j] ;
+                reg[j] = (unsigned char) ((k >= q) ? k-q : k) ;
+            }
+            if (!tmp)           /* store root and errata location number indices */
+            {   root[count] = (unsigned char) ((p*(q-rs->par.prim)) % q) ;
+                loc[count]  = (unsigned char) p ;
+                count++ ;
+            }
+        }
+    }
+    RS_PROF_LAP(RS_STAGE_CHIEN, t) ;
+    if (count != deg_lambda)    /* no. roots != degree of lambda => cannot solve */
+    {   RS_PROF_ERRATA(-1) ;
+        return -1 ;
+    }
+
+/* form omega(X) = s(X)*lambda(X) mod X**np; its degree is below that of
+   lambda(X)                                                               */
+    deg_omega = deg_lambda-1 ;
+    for (i=0; i<=deg_omega; i++)
+    {   tmp = 0 ;
+        for (j=i; j>=0; j--)
+            tmp ^= gf_mul(rs, lambda[j], syn[i-j]) ;
+        omega[i] = (unsigned char) tmp ;
+    }
+
+/* Forney: errata value = X**(1-fcr) * omega(X**-1) / lambda'(X**-1); only the
+   odd terms of lambda survive in its formal derivative. The powers of X**-1
+   are accumulated in index form and alpha_to[] is doubled, so no reductions
+   modulo q are needed per term.                                                                   */
+    for (j=0; j<count; j++)
+    {   num = 0 ;
+        for (i=0, k=0; i<=deg_omega; i++)
+        {   if (omega[i] != 0)
+            {   tmp = index_of[omega[i]]+k ;
+                num ^= alpha_to[tmp] ;
+            }
+            k += root[j] ;
+            if (k >= q)  k -= q ;
+        }
+        den = 0 ;
+        r2  = 2*root[j] % q ;
+        for (i=0, k=0; i<deg_lambda; i+=2)
+        {   if (lambda[i+1] != 0)
+            {   tmp = index_of[lambda[i+1]]+k ;
+                den ^= alpha_to[tmp] ;
+            }
+            k += r2 ;
+            if (k >= q)  k -= q ;
+        }
+        if (den == 0)
+        {   status->count = 0 ;
+            RS_PROF_ERRATA(-1) ;
+            return -1 ;
+        }
+        if (num != 0)
+        {   tmp  = (root[j]*(rs->par.fcr%q + q-1)) % q ;    /* X**(1-fcr) = alpha**(root*(fcr-1)) */
+            tmp += index_of[num] + q-index_of[den] ;
+            if (tmp >= q)  tmp -= q ;
+            status->loc[status->count] = loc[j] ;
+            status->mag[status->count] = (MSG_TYPE) alpha_to[tmp] ;
+            status->count++ ;
+        }
+        else
+        {   /* a zero errata value means a wrong locator, except at an erasure */
+            for (i=0; i<no_eras && eras_pos[i]!=loc[j]; i++) ;
+            if (i == no_eras)
+            {   status->count = 0 ;
+                RS_PROF_ERRATA(-1) ;
+                return -1 ;
+            }
+        }
+    }
+
+    RS_PROF_LAP(RS_STAGE_FORNEY, t) ;
+
+/* only correct the word once all errata values are known */
+    for (j=0; j<status->count; j++)
+        if (status->loc[j] < np)
+            bb[status->loc[j]*stride] ^= status->mag[j] ;
+        else
+            data[(status->loc[j]-np)*stride] ^= status->mag[j] ;
+    status->success = 1 ;
+    RS_PROF_LAP(RS_STAGE_CORRECT, t) ;
+    RS_PROF_ERRATA(status->count) ;
+
+    return status->count ;
+}
+
+static inline int rs_decode_buf(const rs_codec_t * rs, MSG_TYPE * data, int len, MSG_TYPE * bb,
+                                const int * eras_pos, int no_eras, decode_status_t * status)
+{
+    return rs_decode_np(rs, rs->q, rs->np, data, len, 1, bb, eras_pos, no_eras, status) ;
+}
+
+// rs_decode_buf() of a codeword whose symbols are stride symbols apart, see rs_encode_strided().
+static inline int rs_decode_strided(const rs_codec_t * rs, MSG_TYPE * data, int len, int stride, MSG_TYPE * bb,
+                                    const int * eras_pos, int no_eras, decode_status_t * status)
+{
+    return rs_decode_np(rs, rs->q, rs->np, data, len, stride, bb, eras_pos, no_eras, status) ;
+}
+
+/*
+ * FIXED DECODERS
+ *
+ * RS_FIXED_DECODER(name, codec, M, N, K) defines
+ *      int name_decode(data, len, bb, eras_pos, no_eras, status)
+ * the decoder of codec, specialised on the code parameters, which must be
+ * constants matching the codec. Meant for the static codecs of rs_gen.c;
+ * gives the same results as rs_decode_buf(&codec, data, len, bb, ...).
+ */
+
+#define RS_FIXED_DECODER(name, codec, M, N, K) \
+static inline int name##_decode(MSG_TYPE * data, int len, MSG_TYPE * bb, const int * eras_pos, int no_eras, \
+                                decode_status_t * status) \
+{ \
+    return rs_decode_np(&(codec), (1<<(M))-1, (N)-(K), data, len, 1, bb, eras_pos, no_eras, status) ; \
+}
+
+#ifdef RS_STATIC_DEFAULT
+RS_FIXED_DECODER(rs_static_default, rs_static_default, mm, nn, kk)
+#endif
+
+// Fail a decode before it starts: clear status (if not NULL) and return -1.
+static inline int rs_decode_reject(decode_status_t * status)
+{
+    if (status != NULL)
+    {   status->success  = 0 ;
+        status->syn_zero = 0 ;
+        status->count    = 0 ;
+    }
+    return -1 ;
+}
+
+/* Errors-and-erasures decoding of a packet with codec rs, see rs_decode_buf().
+   Only the F_length = packet->header[3] data symbols of the packet are part
+   of the (shortened) codeword; data[F_length..kk-1] are neither read nor
+   corrected. The codec must have nn-kk parity symbols to match the packet
+   layout, but may use any field and roots; returns -1 otherwise. Erasure and
+   error locations are codeword positions, see recd_rs().                 */
+static inline int rs_decode_erasures(const rs_codec_t * rs, packet_t * packet, const int * eras_pos, int no_eras,
+                                     decode_status_t * status)
+{
+    if (rs->np != nn-kk)
+        return rs_decode_reject(status) ;
+
+    return rs_decode_buf(rs, packet->data, packet->header[3], packet->ECF, eras_pos, no_eras, status) ;
+}
+
+// Errors-only decoding of a packet with codec rs, correcting it in place.
+static inline int rs_decode(const rs_codec_t * rs, packet_t * packet, decode_status_t * status)
+{
+    return rs_decode_erasures(rs, packet, NULL, 0, status) ;
+}
+
+/* Errors-only decoding of a packet in wire format (see serialize_packet()),
+   in place in the size bytes at buf, e.g. a DMA or socket receive buffer.
+   Nothing is copied: the codeword is read once for the syndromes and only the
+   corrected symbols are written. Returns the number of corrected symbols, or
+   -1 if the errata could not be corrected or buf does not hold a whole
+   packet.                                                                 */
+static inline int rs_decode_wire(const rs_codec_t * rs, MSG_TYPE * buf, int size, decode_status_t * status)
+{
+    int F_length ;
+
+    if (rs->np != nn-kk || size < HEADER_SIZE)
+        return rs_decode_reject(status) ;
+    F_length = buf[3] ;
+    if (F_length > kk || size < HEADER_SIZE + F_length + (nn-kk))
+        return rs_decode_reject(status) ;
+
+    return rs_decode_buf(rs, &buf[HEADER_SIZE], F_length, &buf[HEADER_SIZE + F_length], NULL, 0, status) ;
+}
+
+/*
+ * Versions of the above using the default codec
+ */
+
+static inline int syndromes_rs(const packet_t * packet, unsigned char * s)
+{
+    return rs_syndromes(rs_default_codec(), packet, s) ;
+}
+
+static inline int check_rs(const packet_t * packet)
+{
+    return rs_check(rs_default_codec(), packet) ;
+}
+
+static inline int decode_rs(packet_t * packet, decode_status_t * status)
+{
+#ifdef RS_STATIC_DEFAULT
+    return rs_static_default_decode(packet->data, packet->header[3], packet->ECF, NULL, 0, status) ;
+#else
+    return rs_decode(rs_default_codec(), packet, status) ;
+#endif
+}
+
+static inline int decode_rs_erasures(packet_t * packet, const int * eras_pos, int no_eras, decode_status_t * status)
+{
+#ifdef RS_STATIC_DEFAULT
+    return rs_static_default_decode(packet->data, packet->header[3], packet->ECF, eras_pos, no_eras, status) ;
+#else
+    return rs_decode_erasures(rs_default_codec(), packet, eras_pos, no_eras, status) ;
+#endif
+}
+
+static inline int decode_wire(MSG_TYPE * buf, int size, decode_status_t * status)
+{
+#ifdef RS_STATIC_DEFAULT
+    int F_length ;
+
+    if (size < HEADER_SIZE)
+        return rs_decode_reject(status) ;
+    F_length = buf[3] ;
+    if (F_length > kk || size < HEADER_SIZE + F_length + (nn-kk))
+        return rs_decode_reject(status) ;
+
+    return rs_static_default_decode(&buf[HEADER_SIZE], F_length, &buf[HEADER_SIZE + F_length], NULL, 0, status) ;
+#else
+    return rs_decode_wire(rs_default_codec(), buf, size, status) ;
+#endif
+}
+
+/*
+ * TRANSFERS
+ *
+ * Decoding and reassembly of the transfers of transfer.h, with the default
+ * codec.
+ */
+
+/*
+ * Decode all packets of a transfer and return the decoding statistics.
+ * If status is not NULL, the status of packet i is stored in status[i].
+ */
+static inline transfer_stats_t decode_transfer(transfer_t * transfer, decode_status_t * status)
+{
+    register int i;
+    decode_status_t packet_status;
+    transfer_stats_t stats = { 0 };
+
+    //printf("Decoding %i data packets...\n", transfer->size);
+
+    RS_PROF_START(t);
+
+    for (i = 0; i < transfer->size; i++)
+    {
+        decode_status_t * st = (status != NULL) ? &status[i] : &packet_status;
+
+        decode_rs(&(transfer->packs[i]), st);
+        count_status(&stats, st);
+    }
+
+    RS_PROF_LAP(RS_STAGE_TRANSFER_DECODE, t);
+
+    return stats;
+}
+
+#define UNPACK_WINDOW 65536   // # of sequence numbers unpack_transfer_to() checks per pass, on the stack
+
+/*
+ * Decode a transfer and reassemble the message in msg[], which holds capacity
+ * bytes. The packets may be in any order: the data of every packet is placed
+ * by its sequence number, at msg[seq*kk], through a reassembly whose bitmap
+ * rejects numbers that are out of range, duplicates or do not fit the frame
+ * length (see reassembly_place_seq()); a transfer of more than UNPACK_WINDOW
+ * packets takes a pass over the packets per UNPACK_WINDOW numbers. The header
+ * is not protected, so unless the numbers are an exact permutation of the
+ * packets, some are corrupted: the message is then reassembled in index
+ * order instead, as the packets were generated by fill_transfer(), and the
+ * packets rejected and numbers missing are counted in stats->misplaced and
+ * stats->missing. Either way every byte of msg[0..size-1] is written.
+ *
+ * If stats is not NULL the decoding statistics are stored in it; check
+ * stats->uncorrectable (and misplaced) before trusting the message. Returns
+ * the size of the message, or -1 (without decoding) if it does not fit in
+ * msg[].
+ */
+static inline int unpack_transfer_to(transfer_t * transfer, MSG_TYPE * msg, int capacity, transfer_stats_t * stats)
+{
+    register int i, N = 0;
+    _Atomic unsigned int received[REASSEMBLY_WORDS(UNPACK_WINDOW * kk)];
+    reassembly_t r;
+    int first, seq, placed = 0, invalid = 0;
+
+    // Determine message size
+    for (i = 0; i<transfer->size; i++)
+        N += transfer->packs[i].header[3];
+
+    if (N > capacity) return -1;
+
+    transfer_stats_t st = decode_transfer(transfer, NULL);
+
+    // Place the packets by sequence number, numbers first..first+UNPACK_WINDOW-1 per pass
+    for (first = 0; first < transfer->size && first*kk < N; first += UNPACK_WINDOW)
+    {
+        reassembly_init_static(&r, &msg[first*kk], (N - first*kk < UNPACK_WINDOW*kk) ? N - first*kk : UNPACK_WINDOW*kk,
+                               received);
+
+        for (i = 0; i < transfer->size; i++)
+        {
+            seq = packet_seq(&(transfer->packs[i]));
+
+            if (seq >= transfer->size)
+                invalid += (first == 0);
+            else if (seq >= first && seq - first < UNPACK_WINDOW)
+                reassembly_place_seq(&r, seq - first, transfer->packs[i].header[3], transfer->packs[i].data);
+        }
+
+        placed  += atomic_load_explicit(&r.placed, memory_order_relaxed);
+        invalid += atomic_load_explicit(&r.invalid, memory_order_relaxed) +
+                   atomic_load_explicit(&r.duplicates, memory_order_relaxed);
+    }
+
+    st.misplaced = invalid;
+    st.missing   = transfer->size - placed;
+
+    // Not an exact permutation: copy the data of all packets in index order to form single message array
+    if (st.misplaced > 0 || st.missing > 0)
+        for (i = 0, N = 0; i<transfer->size; i++)
+        {
+            memcpy(&msg[N], transfer->packs[i].data, transfer->packs[i].header[3] * sizeof(MSG_TYPE));
+            N += transfer->packs[i].header[3];
+        }
+
+    if (stats != NULL) *stats = st;
+
+    return N;
+}
+
+#ifndef RS_NO_HEAP
+/*
+ * unpack_transfer_to() into a newly allocated message; free it when done.
+ */
+static inline MSG_TYPE * unpack_transfer(transfer_t * transfer, transfer_stats_t * stats)
+{
+    register int i, N = 0;
+
+    // Determine message size
+    for (i = 0; i<transfer->size; i++)
+        N += transfer->packs[i].header[3];
+
+    /*
+     * It might not be as straightforward to unpack a transfer frame
+     * after it has been received, since the size (in # of packets) needs
+     * to be transmitted to the receiver alongside the message.
+     */
+
+    MSG_TYPE * msg = malloc(N * sizeof(MSG_TYPE));
+
+    unpack_transfer_to(transfer, msg, N, stats);
+
+    return msg;
+}
+#endif
+
+/*
+ * Decode a transfer in place and store the view of the data of packet i in
+ * views[i], see unpack_transfer(). Returns the size of the message.
+ */
+static inline int view_transfer(transfer_t * transfer, data_view_t * views, transfer_stats_t * stats)
+{
+    register int i, N = 0;
+
+    transfer_stats_t st = decode_transfer(transfer, NULL);
+    if (stats != NULL) *stats = st;
+
+    for (i = 0; i < transfer->size; i++)
+    {
+        views[i] = packet_view(&(transfer->packs[i]));
+        N += views[i].size;
+    }
+
+    return N;
+}
+
+/*
+ * Decode a packet in place and place its data. If status is not NULL, the
+ * decoding status is stored in it. Returns 0 if the packet has been placed,
+ * -1 if it is rejected.
+ */
+static inline int reassembly_add(reassembly_t * r, packet_t * packet, decode_status_t * status)
+{
+    decode_status_t st;
+
+    if (status == NULL) status = &st;
+
+    if (decode_rs(packet, status) < 0)
+    {
+        atomic_fetch_add_explicit(&(r->invalid), 1, memory_order_relaxed);
+        return -1;
+    }
 
+    return reassembly_place(r, packet->header, packet->data);
 }
 
 #endif //DECODER_H
\ No newline at end of file
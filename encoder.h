@@ -2,17 +2,154 @@
 #define ENCODER_H
 
 #include "transfer.h"
+#include "gf_simd.h"
+
+/* rs_encode_buf() of a codeword whose symbols are stride symbols apart, i.e.
+   data symbol i is data[i*stride] and parity symbol j is bb[j*stride], as in
+   a frame of stride interleaved codewords (see interleave.h).          */
+static inline int rs_encode_strided(const rs_codec_t * rs, const MSG_TYPE * data, int len, int stride, MSG_TYPE * bb)
+{
+    if (len < 0 || len > rs->par.k || stride < 1)
+        return -1 ;
+
+    RS_PROF_START(t) ;
+    gf_active()->encode(rs, data, len, stride, bb) ;
+    RS_PROF_LAP(RS_STAGE_ENCODE, t) ;
+    return 0 ;
+}
+
+/* Systematic encoding of the len data symbols data[0..len-1] into the np
+   parity symbols bb[0..np-1] of the code of codec rs, using the fastest
+   kernel available on this CPU (see gf_simd.h). len may be less than k, in
+   which case the code is shortened further: the missing data symbols are
+   zero and are not transmitted. Returns 0, or -1 if len > k.          */
+static inline int rs_encode_buf(const rs_codec_t * rs, const MSG_TYPE * data, int len, MSG_TYPE * bb)
+{
+    return rs_encode_strided(rs, data, len, 1, bb) ;
+}
+
+/* Systematic encoding of a packet with codec rs: the F_length =
+   packet->header[3] data symbols in packet->data[] are encoded into
+   packet->ECF[]. Short frames use the shortened code: data[F_length..kk-1]
+   are taken to be zero, whatever they hold, and are not iterated over. For a
+   zero padded packet this produces the same parity symbols as
+   encode_rs_ref(). The codec must have nn-kk parity symbols to match the
+   packet layout, but may use any field and roots; returns -1 otherwise or
+   if F_length > kk.                                                    */
+static inline int rs_encode(const rs_codec_t * rs, packet_t * packet)
+{
+    if (rs->np != nn-kk)
+        return -1 ;
+
+    return rs_encode_buf(rs, packet->data, packet->header[3], packet->ECF) ;
+}
+
+#define RS_BATCH_MIN 4      /* smaller batches are encoded one by one */
+
+/* Encode the n independent codewords data[c][0..len[c]-1] -> bb[c][0..np-1],
+   c=0..n-1, of codec rs together, one per vector lane (see gf_simd.h). Gives
+   the same parity as rs_encode_buf() per codeword, at several times its
+   throughput once n is 16 or more. Returns 0, or -1 if any len[c] > k.  */
+static inline int rs_encode_batch(const rs_codec_t * rs, const MSG_TYPE * const * data, const int * len,
+                                  MSG_TYPE * const * bb, int n)
+{
+    register int c ;
+
+    for (c=0; c<n; c++)
+        if (len[c] < 0 || len[c] > rs->par.k)
+            return -1 ;
+
+    RS_PROF_START(t) ;
+    if (n < RS_BATCH_MIN)
+        for (c=0; c<n; c++)
+            gf_active()->encode(rs, data[c], len[c], 1, bb[c]) ;
+    else
+        gf_active()->encode_batch(rs, data, len, bb, n) ;
+    RS_PROF_LAP(RS_STAGE_ENCODE, t) ;
+    return 0 ;
+}
+
+/* rs_encode() of the n packets packs[0..n-1], batched with
+   rs_encode_batch(). Returns -1 if rs does not match the packet layout or a
+   frame length is over kk, in which case no packet is encoded.          */
+static inline int rs_encode_packets(const rs_codec_t * rs, packet_t * packs, int n)
+{
+    register int i, c ;
+    const MSG_TYPE * data[GF_BATCH] ;
+    MSG_TYPE * bb[GF_BATCH] ;
+    int len[GF_BATCH], m ;
+
+    if (rs->np != nn-kk)
+        return -1 ;
+    for (i=0; i<n; i++)
+        if (packs[i].header[3] > kk)
+            return -1 ;
+
+    for (i=0; i<n; i+=GF_BATCH)
+    {   m = (n-i < GF_BATCH) ? n-i : GF_BATCH ;
+        for (c=0; c<m; c++)
+        {   data[c] = packs[i+c].data ;
+            len[c]  = packs[i+c].header[3] ;
+            bb[c]   = packs[i+c].ECF ;
+        }
+        rs_encode_batch(rs, data, len, bb, m) ;
+    }
+
+    return 0 ;
+}
+
+/*
+ * FIXED ENCODERS
+ *
+ * RS_FIXED_ENCODER(name, codec, N, K) defines
+ *      int name_encode(data, len, bb)
+ * the encoder of len <= K data symbols with codec, specialised on the code
+ * parameters, which must be constants matching the codec: the N-K tap
+ * register is fully unrolled. Meant for the static codecs of rs_gen.c; gives
+ * the same parity as rs_encode_buf(&codec, data, len, bb).
+ */
+
+#define RS_FIXED_ENCODER(name, codec, N, K) \
+static inline int name##_encode(const MSG_TYPE * data, int len, MSG_TYPE * bb) \
+{ \
+    if (len < 0 || len > (K)) \
+        return -1 ; \
+    RS_PROF_START(t) ; \
+    gf_encode_np(&(codec), (N)-(K), data, len, 1, bb) ; \
+    RS_PROF_LAP(RS_STAGE_ENCODE, t) ; \
+    return 0 ; \
+}
+
+#ifdef RS_STATIC_DEFAULT
+RS_FIXED_ENCODER(rs_static_default, rs_static_default, nn, kk)
+#endif
+
+// rs_encode() with the default codec
+static inline void encode_rs(packet_t * packet)
+{
+    rs_encode(rs_default_codec(), packet) ;
+}
+
+// rs_encode_packets() with the default codec
+static inline void encode_packets(packet_t * packs, int n)
+{
+    rs_encode_packets(rs_default_codec(), packs, n) ;
+}
 
 /* take the string of symbols in data[i], i=0..(k-1) and encode systematically
    to produce 2*tt parity symbols in bb[0]..bb[2*tt-1]
    data[] is input and bb[] is output in polynomial form.
    Encoding is done by using a feedback shift register with appropriate
    connections specified by the elements of gg[], which was generated above.
-   Codeword is   c(X) = data(X)*X**(nn-kk)+ b(X)          */
-void encode_rs(packet_t * packet)
+   Codeword is   c(X) = data(X)*X**(nn-kk)+ b(X)
+   This is the original bit-serial encoder, kept as a reference; rs must be a
+   codec for an RS(nn,kk) code over GF(2**mm).                         */
+static inline void encode_rs_ref(const rs_codec_t * rs, packet_t * packet)
 {
     register int i,j ;
     int feedback ;
+    const unsigned char * alpha_to = rs->alpha_to ;
+    const short * index_of = rs->index_of, * gg = rs->gg ;
 
     for (i=0; i<nn-kk; i++)   packet->ECF[i] = 0 ;
         for (i=kk-1; i>=0; i--)
@@ -33,4 +170,172 @@ void encode_rs(packet_t * packet)
             }
 }
 
+/*
+ * PACKETS AND TRANSFERS
+ *
+ * Framing of messages into the packets of transfer.h, with the default codec.
+ * The packets of a transfer are independent codewords, so they are encoded
+ * in batches (encode_packets()), many packets at once, rather than one by one.
+ */
+
+#define ENCODE_BATCH 64     // # of packets filled and then encoded together, while they are in cache
+
+static inline void encode_transfer(transfer_t * transfer)
+{
+    // Error correction field
+    encode_packets(transfer->packs, transfer->size);
+}
+
+/*
+ * Fill a single packet with F_length bytes of data and generate its ECF.
+ * Every packet is encoded exactly once, after all of its data is in place.
+ */
+static inline void fill_packet(packet_t * packet, const MSG_TYPE * data, const int F_length, const int seq)
+{
+    fill_header(packet, F_length, seq);
+
+    if (packet->data != data)
+        memcpy(packet->data, data, F_length * sizeof(MSG_TYPE));
+
+    // Generate ECF
+    encode_rs(packet);
+}
+
+/*
+ * Split a message over the packets at packs[], which must hold
+ * TRANSFER_PACKETS(size) packets, and encode them.
+ */
+static inline transfer_t fill_transfer(packet_t * packs, const MSG_TYPE * data, const int size)
+{
+    register int i;
+
+    transfer_t transfer;
+
+    transfer.size   = TRANSFER_PACKETS(size); // # of packets required to store message
+    transfer.packs  = packs;
+
+    //printf("Generating %i packets...\n", transfer.size);
+
+    int F_length;
+
+    RS_PROF_START(t);
+
+    /*
+     * Fill data packet(s)
+     */
+
+    for (i = 0; i < transfer.size; i++)
+    {
+        F_length = ((size - (i+1)*kk) < 0) ? (size % kk) : kk; // Frame length
+        //printf("Frame Length packet[%i] = %d\n", i, F_length);
+
+        fill_header(&(transfer.packs[i]), F_length, i);
+        memcpy(transfer.packs[i].data, &data[i*kk], F_length * sizeof(MSG_TYPE));
+
+        // Generate the ECF of every ENCODE_BATCH packets
+        if ((i+1) % ENCODE_BATCH == 0 || i+1 == transfer.size)
+            encode_packets(&(transfer.packs[i - i % ENCODE_BATCH]), i % ENCODE_BATCH + 1);
+    }
+
+    RS_PROF_LAP(RS_STAGE_TRANSFER_ENCODE, t);
+
+    return transfer;
+}
+
+#ifndef RS_NO_HEAP
+// fill_transfer() into newly allocated packets; free transfer.packs when done.
+static inline transfer_t gen_transfer(const MSG_TYPE * data, const int size)
+{
+    return fill_transfer(malloc(TRANSFER_PACKETS(size) * sizeof(packet_t)), data, size);
+}
+#endif
+
+/*
+ * gen_transfer() into packets taken from the pool. Returns 0 on success, -1
+ * if the pool has not enough packets left.
+ */
+static inline int packet_pool_transfer(packet_pool_t * pool, transfer_t * transfer, const MSG_TYPE * data, const int size)
+{
+    packet_t * packs = packet_pool_alloc(pool, TRANSFER_PACKETS(size));
+
+    if (packs == NULL) return -1;
+
+    *transfer = fill_transfer(packs, data, size);
+
+    return 0;
+}
+
+/*
+ * STREAMING ENCODER
+ *
+ * Frames a message of arbitrary (and possibly unknown) length while it is
+ * being produced. Input can be written in chunks of any size; as soon as a
+ * packet is full it is encoded once and handed to the emit() callback, so only
+ * a single packet_t is held in memory regardless of the message size.
+ * The packets emitted are identical to those generated by gen_transfer().
+ *
+ * Usage:
+ *      encode_stream_init(&stream, emit, user);
+ *      encode_stream_write(&stream, chunk, chunk_size);   // repeatedly
+ *      encode_stream_flush(&stream);                      // final (partial) packet
+ */
+
+typedef void (*emit_packet_t)(const packet_t * packet, void * user);
+
+struct encode_stream {
+
+    packet_t packet;        // Packet currently being filled
+    int fill;               // # of data bytes in packet
+    int seq;                // Frame sequence number of packet
+
+    emit_packet_t emit;     // Called for every finished packet
+    void * user;            // Passed on to emit()
+
+};
+
+typedef struct encode_stream encode_stream_t;
+
+static inline void encode_stream_init(encode_stream_t * stream, emit_packet_t emit, void * user)
+{
+    stream->fill = 0;
+    stream->seq  = 0;
+    stream->emit = emit;
+    stream->user = user;
+}
+
+// Encode and emit the packet in the stream buffer; a partly filled one is sent as a short frame of fill bytes
+static inline void encode_stream_emit(encode_stream_t * stream)
+{
+    fill_packet(&(stream->packet), stream->packet.data, stream->fill, stream->seq);
+    stream->emit(&(stream->packet), stream->user);
+
+    stream->fill = 0;
+    stream->seq++;
+}
+
+static inline void encode_stream_write(encode_stream_t * stream, const MSG_TYPE * data, int size)
+{
+    register int n;
+
+    while (size > 0)
+    {
+        n = kk - stream->fill;
+        if (n > size) n = size;
+
+        memcpy(&(stream->packet.data[stream->fill]), data, n * sizeof(MSG_TYPE));
+        stream->fill += n;
+        data += n;
+        size -= n;
+
+        if (stream->fill == kk)
+            encode_stream_emit(stream);
+    }
+}
+
+static inline void encode_stream_flush(encode_stream_t * stream)
+{
+    if (stream->fill > 0)
+        encode_stream_emit(stream);
+}
+
 #endif //ENCODER_H
\ No newline at end of file
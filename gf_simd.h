@@ -0,0 +1,588 @@
+#ifndef GF_SIMD_H
+#define GF_SIMD_H
+
+#include "rs.h"
+
+/*
+ * ----------VECTORISED GF(2**8) KERNELS----------
+ *
+ * Kernels for the two hot loops of the codec: parity generation (encode) and
+ * syndrome computation (decode). Each kernel comes in a scalar version and in
+ * SSSE3, AVX2, AVX-512BW and GFNI versions which process 16/32/64 symbols at
+ * a time. The kernel set is chosen once, at runtime, from CPUID; see gf_active().
+ *
+ * Multiplication of a vector by a symbol r is done either with two PSHUFB
+ * lookups in the split-nibble tables rs->nib[r] or with a single GFNI affine
+ * transformation by the bit matrix rs->aff[r] (both built by rs_init()).
+ * These tables hold the products of the codec's own field, so the kernels
+ * work for any m <= 8 and any primitive polynomial.
+ *
+ * Syndromes: all np = n-k syndromes are accumulated at once, one received
+ * symbol r_j at a time:   s ^= r_j * col[j]   where col[j] (see rs_codec_t)
+ * holds the weights of r_j in the np syndromes. The received word is passed
+ * as its two parts, the parity bb[] (positions 0..np-1) and the data[]
+ * (positions np and up), exactly as they are laid out in a packet, so no copy
+ * is needed.
+ *
+ * Encoding: the np symbol parity register is kept in vector registers; per
+ * data symbol the register is shifted by one symbol and the feedback row
+ * rs->gg_mul[f] is XORed in. The feedback symbol changes every step, so a table
+ * row is cheaper than a multiplication here, and wider registers would only
+ * add cross-lane shuffles; all vector kernel sets share the SSSE3 encoder.
+ *
+ * Batch encoding: codewords are independent, so a batch of them is encoded
+ * with one codeword per vector lane (16/32/64 lanes). The batch is transposed
+ * into columns, column i holding data symbol i of every codeword, and the
+ * register is held as np vectors, register symbol j of every codeword. Per
+ * data symbol, the feedback vector f is multiplied by the constant generator
+ * coefficients g_j, with two PSHUFB lookups in the tables of g_j or with one
+ * GFNI affine transformation. There is no dependency between the lanes, so
+ * this runs at throughput rather than at the latency of the feedback chain.
+ * Shorter codewords are zero padded at the top, which leaves their register
+ * at zero until their first data symbol, so codewords of any lengths can be
+ * batched together.
+ *
+ * The vector kernels are written for the common sizes: syndromes for np a
+ * multiple of 16 (two symbols per step for np = 32 on AVX-512), the encoder
+ * for np = 16 and 32. Other codes fall back to the next narrower kernel and
+ * finally to the scalar one.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GF_X86
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+/* data[0..len-1] -> bb[0..np-1], symbol i of data and bb at [i*stride], so that
+   interleaved codewords (see interleave.h) are processed in place */
+typedef void (*gf_encode_t)(const rs_codec_t * rs, const unsigned char * data, int len, int stride, unsigned char * bb);
+// (bb[0..np-1], data[0..len-1]) -> s[0..np-1] = s_1..s_np, polynomial form, stride as above
+typedef void (*gf_syndromes_t)(const rs_codec_t * rs, const unsigned char * data, int len, int stride, const unsigned char * bb, unsigned char * s);
+// data[c][0..len[c]-1] -> bb[c][0..np-1] for the n codewords c=0..n-1
+typedef void (*gf_encode_batch_t)(const rs_codec_t * rs, const unsigned char * const * data, const int * len,
+                                  unsigned char * const * bb, int n);
+
+struct gf_kernels {
+
+    const char * name;
+    gf_encode_t encode;
+    gf_syndromes_t syndromes;
+    gf_encode_batch_t encode_batch;
+
+};
+
+#define GF_BATCH 64     // Widest batch kernel, in codewords
+
+typedef struct gf_kernels gf_kernels_t;
+
+/*
+ * SCALAR
+ */
+
+/* Table driven version of the feedback shift register in encode_rs_ref(),
+   for a code with np parity symbols. Each data symbol costs one lookup of its
+   feedback row in rs->gg_mul[][] and np XORs. Instead of shifting the
+   register, the register is a window sliding down through reg[], so that the
+   update is free of both shifts and branches. Called with a constant np the
+   XOR loop is fully unrolled (see RS_FIXED_ENCODER).                   */
+static RS_INLINE void gf_encode_np(const rs_codec_t * rs, const int np, const unsigned char * data, int len,
+                                   int stride, unsigned char * bb)
+{
+    register int i,j ;
+    unsigned char reg[RS_MAX_NN], * w ;
+    const unsigned char * row ;
+
+    w = &reg[len] ;                     /* w[j] holds bb[j*stride] */
+    for (j=0; j<np; j++)   w[j] = 0 ;
+
+    for (i=len-1; i>=0; i--)
+    {   row = rs->gg_mul[data[i*stride]^w[np-1]] ;
+        *(--w) = 0 ;
+        for (j=0; j<np; j++)
+            w[j] ^= row[j] ;
+    }
+
+    for (j=0; j<np; j++)   bb[j*stride] = w[j] ;
+}
+
+// a*b in polynomial form, from the split-nibble tables: no branches and no reductions modulo q
+static inline int gf_mul(const rs_codec_t * rs, int a, int b)
+{
+    return rs->nib[a][0][b & 0xF] ^ rs->nib[a][1][b >> 4] ;
+}
+
+static inline void gf_encode_scalar(const rs_codec_t * rs, const unsigned char * data, int len, int stride, unsigned char * bb)
+{
+    gf_encode_np(rs, rs->np, data, len, stride, bb) ;
+}
+
+static inline void gf_encode_batch_scalar(const rs_codec_t * rs, const unsigned char * const * data, const int * len,
+                                          unsigned char * const * bb, int n)
+{
+    register int c ;
+
+    for (c=0; c<n; c++)
+        gf_encode_np(rs, rs->np, data[c], len[c], 1, bb[c]) ;
+}
+
+/* Transpose the n <= lanes codewords data[c][0..len[c]-1] into columns,
+   cols[i*lanes + c] = data[c][i], zero padded up to the longest codeword and
+   in the unused lanes. Returns the length of the longest codeword.      */
+static inline int gf_batch_columns(const unsigned char * const * data, const int * len, int n, int lanes,
+                                   unsigned char * cols)
+{
+    register int i, c ;
+    int max = 0 ;
+
+    for (c=0; c<n; c++)
+        if (len[c] > max)  max = len[c] ;
+
+    memset(cols, 0, max*lanes) ;
+    for (c=0; c<n; c++)
+        for (i=0; i<len[c]; i++)
+            cols[i*lanes + c] = data[c][i] ;
+
+    return max ;
+}
+
+// Scatter the parity columns par[j*lanes + c] = bb[c][j] back to the n codewords
+static inline void gf_batch_parity(const unsigned char * par, int np, int n, int lanes, unsigned char * const * bb)
+{
+    register int j, c ;
+
+    for (c=0; c<n; c++)
+        for (j=0; j<np; j++)
+            bb[c][j] = par[j*lanes + c] ;
+}
+
+static inline void gf_syndromes_scalar(const rs_codec_t * rs, const unsigned char * data, int len, int stride, const unsigned char * bb, unsigned char * s)
+{
+    register int i,j,r ;
+    const int np = rs->np ;
+    const unsigned char * lo, * hi, * col ;
+    unsigned char acc[RS_MAX_ROOTS] ;   /* local, so that it cannot alias the tables */
+
+    for (i=0; i<np; i++)   acc[i] = 0 ;
+
+    for (j=0; j<np+len; j++)
+    {   r = (j < np) ? bb[j*stride] : data[(j-np)*stride] ;
+        if (r == 0)  continue ;
+        lo  = rs->nib[r][0] ;
+        hi  = rs->nib[r][1] ;
+        col = &rs->col[j*np] ;
+        for (i=0; i<np; i++)
+            acc[i] ^= lo[col[i] & 0xF] ^ hi[col[i] >> 4] ;
+    }
+
+    for (i=0; i<np; i++)   s[i] = acc[i] ;
+}
+
+#ifdef GF_X86
+
+/*
+ * SSSE3 - 16 lanes, syndromes in up to two registers per pass
+ */
+
+// r * col, col given by its split nibbles
+__attribute__((target("ssse3")))
+static inline __m128i gf_mul_128(const rs_codec_t * rs, int r, const unsigned char * col_lo, const unsigned char * col_hi)
+{
+    return _mm_xor_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) rs->nib[r][0]),
+                                          _mm_loadu_si128((const __m128i *) col_lo)),
+                         _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) rs->nib[r][1]),
+                                          _mm_loadu_si128((const __m128i *) col_hi)));
+}
+
+/* syndromes s[g..g+31] (or s[g..g+15] for the last pass if np is an odd
+   multiple of 16) per pass over the received word */
+__attribute__((target("ssse3")))
+static inline void gf_syndromes_ssse3(const rs_codec_t * rs, const unsigned char * data, int len, int stride, const unsigned char * bb, unsigned char * s)
+{
+    register int j, g ;
+    const int np = rs->np ;
+    const unsigned char * lo, * hi ;
+    __m128i s0, s1 ;
+
+    if (np % 16 != 0)
+    {   gf_syndromes_scalar(rs, data, len, stride, bb, s) ;
+        return ;
+    }
+
+    for (g=0; g<np; g+=32)
+    {   s0 = _mm_setzero_si128() ;
+        s1 = _mm_setzero_si128() ;
+        lo = &rs->col_lo[g] ;
+        hi = &rs->col_hi[g] ;
+
+        if (np-g >= 32)
+        {   for (j=0; j<np; j++, lo+=np, hi+=np)
+            {   s0 = _mm_xor_si128(s0, gf_mul_128(rs, bb[j*stride], lo,    hi)) ;
+                s1 = _mm_xor_si128(s1, gf_mul_128(rs, bb[j*stride], lo+16, hi+16)) ;
+            }
+            for (j=0; j<len; j++, lo+=np, hi+=np)
+            {   s0 = _mm_xor_si128(s0, gf_mul_128(rs, data[j*stride], lo,    hi)) ;
+                s1 = _mm_xor_si128(s1, gf_mul_128(rs, data[j*stride], lo+16, hi+16)) ;
+            }
+            _mm_storeu_si128((__m128i *) &s[g+16], s1) ;
+        }
+        else
+        {   for (j=0; j<np; j++, lo+=np, hi+=np)
+                s0 = _mm_xor_si128(s0, gf_mul_128(rs, bb[j*stride], lo, hi)) ;
+            for (j=0; j<len; j++, lo+=np, hi+=np)
+                s0 = _mm_xor_si128(s0, gf_mul_128(rs, data[j*stride], lo, hi)) ;
+        }
+        _mm_storeu_si128((__m128i *) &s[g], s0) ;
+    }
+}
+
+/* parity register in one (np = 16) or two (np = 32) halves:
+   lo = bb[0..15], hi = bb[16..31]                                  */
+__attribute__((target("ssse3")))
+static inline void gf_encode_ssse3(const rs_codec_t * rs, const unsigned char * data, int len, int stride, unsigned char * bb)
+{
+    register int i ;
+    register int f ;
+    unsigned char reg[32], * out = (stride == 1) ? bb : reg ;
+    __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+
+    if (rs->np == 32)
+    {   for (i=len-1; i>=0; i--)
+        {   f  = data[i*stride] ^ (_mm_extract_epi16(hi, 7) >> 8);
+            hi = _mm_alignr_epi8(hi, lo, 15);
+            lo = _mm_slli_si128(lo, 1);
+            lo = _mm_xor_si128(lo, _mm_loadu_si128((const __m128i *) &rs->gg_mul[f][0]));
+            hi = _mm_xor_si128(hi, _mm_loadu_si128((const __m128i *) &rs->gg_mul[f][16]));
+        }
+        _mm_storeu_si128((__m128i *) &out[16], hi);
+    }
+    else if (rs->np == 16)
+    {   for (i=len-1; i>=0; i--)
+        {   f  = data[i*stride] ^ (_mm_extract_epi16(lo, 7) >> 8);
+            lo = _mm_slli_si128(lo, 1);
+            lo = _mm_xor_si128(lo, _mm_loadu_si128((const __m128i *) &rs->gg_mul[f][0]));
+        }
+    }
+    else
+    {   gf_encode_scalar(rs, data, len, stride, bb);
+        return;
+    }
+
+    _mm_storeu_si128((__m128i *) &out[0], lo);
+
+    if (out != bb)          /* interleaved parity */
+        for (i=0; i<rs->np; i++)
+            bb[i*stride] = reg[i];
+}
+
+/*
+ * AVX2 - 32 lanes, syndromes in one register per pass
+ */
+
+__attribute__((target("avx2")))
+static inline __m256i gf_mul_256(const rs_codec_t * rs, int r, const unsigned char * col_lo, const unsigned char * col_hi)
+{
+    return _mm256_xor_si256(_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) rs->nib[r][0])),
+                                                _mm256_loadu_si256((const __m256i *) col_lo)),
+                            _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) rs->nib[r][1])),
+                                                _mm256_loadu_si256((const __m256i *) col_hi)));
+}
+
+__attribute__((target("avx2")))
+static inline void gf_syndromes_avx2(const rs_codec_t * rs, const unsigned char * data, int len, int stride, const unsigned char * bb, unsigned char * s)
+{
+    register int j, g ;
+    const int np = rs->np ;
+    __m256i acc ;
+
+    if (np % 32 != 0)
+    {   gf_syndromes_ssse3(rs, data, len, stride, bb, s) ;
+        return ;
+    }
+
+    for (g=0; g<np; g+=32)
+    {   acc = _mm256_setzero_si256() ;
+        for (j=0; j<np; j++)
+            acc = _mm256_xor_si256(acc, gf_mul_256(rs, bb[j*stride], &rs->col_lo[j*np+g], &rs->col_hi[j*np+g])) ;
+        for (j=0; j<len; j++)
+            acc = _mm256_xor_si256(acc, gf_mul_256(rs, data[j*stride], &rs->col_lo[(j+np)*np+g], &rs->col_hi[(j+np)*np+g])) ;
+        _mm256_storeu_si256((__m256i *) &s[g], acc) ;
+    }
+}
+
+/*
+ * AVX-512BW - 64 lanes, two received symbols per step (np = 32)
+ */
+
+// r0 * col[0..31] and r1 * col[32..63]
+__attribute__((target("avx512bw")))
+static inline __m512i gf_mul_512(const rs_codec_t * rs, int r0, int r1, const unsigned char * col_lo, const unsigned char * col_hi)
+{
+    __m512i lo = _mm512_mask_broadcast_i32x4(_mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *) rs->nib[r0][0])),
+                                             0xFF00, _mm_loadu_si128((const __m128i *) rs->nib[r1][0]));
+    __m512i hi = _mm512_mask_broadcast_i32x4(_mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *) rs->nib[r0][1])),
+                                             0xFF00, _mm_loadu_si128((const __m128i *) rs->nib[r1][1]));
+
+    return _mm512_xor_si512(_mm512_shuffle_epi8(lo, _mm512_loadu_si512((const void *) col_lo)),
+                            _mm512_shuffle_epi8(hi, _mm512_loadu_si512((const void *) col_hi)));
+}
+
+__attribute__((target("avx512bw")))
+static inline void gf_syndromes_avx512(const rs_codec_t * rs, const unsigned char * data, int len, int stride, const unsigned char * bb, unsigned char * s)
+{
+    register int j ;
+    __m512i acc = _mm512_setzero_si512();
+    __m256i tail ;
+
+    if (rs->np != 32)
+    {   gf_syndromes_avx2(rs, data, len, stride, bb, s) ;
+        return ;
+    }
+
+    for (j=0; j<32; j+=2)
+        acc = _mm512_xor_si512(acc, gf_mul_512(rs, bb[j*stride], bb[(j+1)*stride], &rs->col_lo[j*32], &rs->col_hi[j*32]));
+    for (j=0; j+1<len; j+=2)
+        acc = _mm512_xor_si512(acc, gf_mul_512(rs, data[j*stride], data[(j+1)*stride], &rs->col_lo[(j+32)*32], &rs->col_hi[(j+32)*32]));
+
+    tail = _mm256_xor_si256(_mm512_castsi512_si256(acc), _mm512_extracti64x4_epi64(acc, 1));
+    if (j < len)
+        tail = _mm256_xor_si256(tail, gf_mul_256(rs, data[j*stride], &rs->col_lo[(j+32)*32], &rs->col_hi[(j+32)*32]));
+
+    _mm256_storeu_si256((__m256i *) s, tail);
+}
+
+/*
+ * GFNI - 64 lanes, two received symbols per step (np = 32), one affine
+ * transformation per multiplication
+ */
+
+__attribute__((target("gfni,avx512bw")))
+static inline void gf_syndromes_gfni(const rs_codec_t * rs, const unsigned char * data, int len, int stride, const unsigned char * bb, unsigned char * s)
+{
+    register int j ;
+    __m512i acc = _mm512_setzero_si512();
+    __m256i tail ;
+
+    if (rs->np != 32)
+    {   gf_syndromes_avx2(rs, data, len, stride, bb, s) ;
+        return ;
+    }
+
+#define GF_MUL_GFNI(r0, r1, col) \
+    _mm512_gf2p8affine_epi64_epi8(_mm512_loadu_si512((const void *) (col)), \
+        _mm512_mask_set1_epi64(_mm512_set1_epi64((long long) rs->aff[r0]), 0xF0, (long long) rs->aff[r1]), 0)
+
+    for (j=0; j<32; j+=2)
+        acc = _mm512_xor_si512(acc, GF_MUL_GFNI(bb[j*stride], bb[(j+1)*stride], &rs->col[j*32]));
+    for (j=0; j+1<len; j+=2)
+        acc = _mm512_xor_si512(acc, GF_MUL_GFNI(data[j*stride], data[(j+1)*stride], &rs->col[(j+32)*32]));
+
+#undef GF_MUL_GFNI
+
+    tail = _mm256_xor_si256(_mm512_castsi512_si256(acc), _mm512_extracti64x4_epi64(acc, 1));
+    if (j < len)
+        tail = _mm256_xor_si256(tail, _mm256_gf2p8affine_epi64_epi8(_mm256_loadu_si256((const __m256i *) &rs->col[(j+32)*32]),
+                                                                    _mm256_set1_epi64x((long long) rs->aff[data[j*stride]]), 0));
+
+    _mm256_storeu_si256((__m256i *) s, tail);
+}
+
+/*
+ * BATCH ENCODERS - one codeword per lane. The register is a window w[0..np-1]
+ * sliding down through reg[], as in gf_encode_np(); g_j = rs->gg_mul[1][j].
+ */
+
+// 16 lanes, f*g_j by PSHUFB in the nibble tables of g_j
+__attribute__((target("ssse3")))
+static inline void gf_encode_batch_ssse3(const rs_codec_t * rs, const unsigned char * const * data, const int * len,
+                                         unsigned char * const * bb, int n)
+{
+    register int i, j ;
+    const int np = rs->np ;
+    int c, m, max ;
+    _Alignas(16) unsigned char cols[RS_MAX_NN*16], par[RS_MAX_ROOTS*16] ;
+    __m128i glo[RS_MAX_ROOTS], ghi[RS_MAX_ROOTS], reg[RS_MAX_NN+RS_MAX_ROOTS], * w, f, flo, fhi ;
+    const __m128i nibble = _mm_set1_epi8(0x0F) ;
+
+    for (j=0; j<np; j++)
+    {   glo[j] = _mm_loadu_si128((const __m128i *) rs->nib[rs->gg_mul[1][j]][0]) ;
+        ghi[j] = _mm_loadu_si128((const __m128i *) rs->nib[rs->gg_mul[1][j]][1]) ;
+    }
+
+    for (c=0; c<n; c+=16)
+    {   m   = (n-c < 16) ? n-c : 16 ;
+        max = gf_batch_columns(&data[c], &len[c], m, 16, cols) ;
+
+        w = &reg[max] ;
+        for (j=0; j<np; j++)   w[j] = _mm_setzero_si128() ;
+
+        for (i=max-1; i>=0; i--)
+        {   f   = _mm_xor_si128(_mm_load_si128((const __m128i *) &cols[i*16]), w[np-1]) ;
+            flo = _mm_and_si128(f, nibble) ;
+            fhi = _mm_and_si128(_mm_srli_epi16(f, 4), nibble) ;
+            *(--w) = _mm_setzero_si128() ;
+            for (j=0; j<np; j++)
+                w[j] = _mm_xor_si128(w[j], _mm_xor_si128(_mm_shuffle_epi8(glo[j], flo), _mm_shuffle_epi8(ghi[j], fhi))) ;
+        }
+
+        for (j=0; j<np; j++)   _mm_store_si128((__m128i *) &par[j*16], w[j]) ;
+        gf_batch_parity(par, np, m, 16, &bb[c]) ;
+    }
+}
+
+// 32 lanes, as above
+__attribute__((target("avx2")))
+static inline void gf_encode_batch_avx2(const rs_codec_t * rs, const unsigned char * const * data, const int * len,
+                                        unsigned char * const * bb, int n)
+{
+    register int i, j ;
+    const int np = rs->np ;
+    int c, m, max ;
+    _Alignas(32) unsigned char cols[RS_MAX_NN*32], par[RS_MAX_ROOTS*32] ;
+    __m256i glo[RS_MAX_ROOTS], ghi[RS_MAX_ROOTS], reg[RS_MAX_NN+RS_MAX_ROOTS], * w, f, flo, fhi ;
+    const __m256i nibble = _mm256_set1_epi8(0x0F) ;
+
+    for (j=0; j<np; j++)
+    {   glo[j] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) rs->nib[rs->gg_mul[1][j]][0])) ;
+        ghi[j] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) rs->nib[rs->gg_mul[1][j]][1])) ;
+    }
+
+    for (c=0; c<n; c+=32)
+    {   m   = (n-c < 32) ? n-c : 32 ;
+        max = gf_batch_columns(&data[c], &len[c], m, 32, cols) ;
+
+        w = &reg[max] ;
+        for (j=0; j<np; j++)   w[j] = _mm256_setzero_si256() ;
+
+        for (i=max-1; i>=0; i--)
+        {   f   = _mm256_xor_si256(_mm256_load_si256((const __m256i *) &cols[i*32]), w[np-1]) ;
+            flo = _mm256_and_si256(f, nibble) ;
+            fhi = _mm256_and_si256(_mm256_srli_epi16(f, 4), nibble) ;
+            *(--w) = _mm256_setzero_si256() ;
+            for (j=0; j<np; j++)
+                w[j] = _mm256_xor_si256(w[j], _mm256_xor_si256(_mm256_shuffle_epi8(glo[j], flo),
+                                                               _mm256_shuffle_epi8(ghi[j], fhi))) ;
+        }
+
+        for (j=0; j<np; j++)   _mm256_store_si256((__m256i *) &par[j*32], w[j]) ;
+        gf_batch_parity(par, np, m, 32, &bb[c]) ;
+    }
+}
+
+// 64 lanes, f*g_j by one affine transformation with the bit matrix of g_j
+__attribute__((target("gfni,avx512bw")))
+static inline void gf_encode_batch_gfni(const rs_codec_t * rs, const unsigned char * const * data, const int * len,
+                                        unsigned char * const * bb, int n)
+{
+    register int i, j ;
+    const int np = rs->np ;
+    int c, m, max ;
+    _Alignas(64) unsigned char cols[RS_MAX_NN*64], par[RS_MAX_ROOTS*64] ;
+    __m512i g[RS_MAX_ROOTS], reg[RS_MAX_NN+RS_MAX_ROOTS], * w, f ;
+
+    for (j=0; j<np; j++)
+        g[j] = _mm512_set1_epi64((long long) rs->aff[rs->gg_mul[1][j]]) ;
+
+    for (c=0; c<n; c+=64)
+    {   m   = (n-c < 64) ? n-c : 64 ;
+        max = gf_batch_columns(&data[c], &len[c], m, 64, cols) ;
+
+        w = &reg[max] ;
+        for (j=0; j<np; j++)   w[j] = _mm512_setzero_si512() ;
+
+        for (i=max-1; i>=0; i--)
+        {   f = _mm512_xor_si512(_mm512_load_si512((const void *) &cols[i*64]), w[np-1]) ;
+            *(--w) = _mm512_setzero_si512() ;
+            for (j=0; j<np; j++)
+                w[j] = _mm512_xor_si512(w[j], _mm512_gf2p8affine_epi64_epi8(f, g[j], 0)) ;
+        }
+
+        for (j=0; j<np; j++)   _mm512_store_si512((void *) &par[j*64], w[j]) ;
+        gf_batch_parity(par, np, m, 64, &bb[c]) ;
+    }
+}
+
+#endif //GF_X86
+
+/*
+ * DISPATCH
+ */
+
+static const gf_kernels_t gf_kernel_list[] = {
+        { "scalar", gf_encode_scalar, gf_syndromes_scalar, gf_encode_batch_scalar },
+#ifdef GF_X86
+        { "ssse3",  gf_encode_ssse3,  gf_syndromes_ssse3,  gf_encode_batch_ssse3  },
+        { "avx2",   gf_encode_ssse3,  gf_syndromes_avx2,   gf_encode_batch_avx2   },
+        { "avx512", gf_encode_ssse3,  gf_syndromes_avx512, gf_encode_batch_avx2   },
+        { "gfni",   gf_encode_ssse3,  gf_syndromes_gfni,   gf_encode_batch_gfni   },
+#endif
+};
+
+#define GF_KERNELS ((int) (sizeof(gf_kernel_list) / sizeof(gf_kernel_list[0])))
+
+static const gf_kernels_t * _Atomic gf_kernels = NULL;
+
+// Returns nonzero if the kernel set can run on this CPU.
+static inline int gf_supported(const gf_kernels_t * kernels)
+{
+#ifdef GF_X86
+    unsigned int a, b, c, d;
+
+    __builtin_cpu_init();
+
+    if (kernels->syndromes == gf_syndromes_ssse3)   return __builtin_cpu_supports("ssse3");
+    if (kernels->syndromes == gf_syndromes_avx2)    return __builtin_cpu_supports("avx2");
+    if (kernels->syndromes == gf_syndromes_avx512)  return __builtin_cpu_supports("avx2") &&
+                                                           __builtin_cpu_supports("avx512bw");
+    if (kernels->syndromes == gf_syndromes_gfni)
+    {
+        if (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("avx512bw")) return 0;
+        if (!__get_cpuid_count(7, 0, &a, &b, &c, &d)) return 0;
+        return (c >> 8) & 1; // CPUID.(EAX=7,ECX=0):ECX.GFNI[bit 8]
+    }
+#endif
+    return kernels->syndromes == gf_syndromes_scalar;
+}
+
+/*
+ * Select a kernel set by name, or the fastest one supported by the CPU when
+ * name is NULL. Returns the selected set, or NULL if it cannot be used.
+ */
+static inline const gf_kernels_t * gf_select(const char * name)
+{
+    register int i;
+
+    for (i = GF_KERNELS-1; i >= 0; i--)
+        if ((name == NULL || strcmp(name, gf_kernel_list[i].name) == 0) && gf_supported(&gf_kernel_list[i]))
+        {
+            atomic_store_explicit(&gf_kernels, &gf_kernel_list[i], memory_order_release);
+            return &gf_kernel_list[i];
+        }
+
+    return NULL;
+}
+
+/*
+ * Currently selected kernel set, picked from CPUID on first use. Safe to call
+ * from any thread: threads that race for the first use pick the same set, and
+ * it is only published if no set has been selected in the meantime.
+ */
+static inline const gf_kernels_t * gf_active()
+{
+    const gf_kernels_t * kernels = atomic_load_explicit(&gf_kernels, memory_order_acquire), * none = NULL;
+    register int i;
+
+    if (kernels == NULL)
+    {
+        for (i = GF_KERNELS-1; !gf_supported(&gf_kernel_list[i]); i--) ;
+
+        kernels = &gf_kernel_list[i];
+        if (!atomic_compare_exchange_strong_explicit(&gf_kernels, &none, kernels, memory_order_acq_rel,
+                                                     memory_order_acquire))
+            kernels = none;
+    }
+
+    return kernels;
+}
+
+#endif //GF_SIMD_H
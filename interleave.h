@@ -0,0 +1,310 @@
+#ifndef INTERLEAVE_H
+#define INTERLEAVE_H
+
+#include "encoder.h"
+#include "decoder.h"
+
+/*
+ * ----------INTERLEAVED FRAMES----------
+ *
+ * A frame carries I = 1..RS_MAX_DEPTH codewords of the default code with their
+ * symbols interleaved, as in CCSDS 131.0-B: symbol i of codeword c is byte
+ * i*I + c of the data part or of the ECF part of the frame body,
+ *
+ *      data:   d_0[0] d_1[0] .. d_(I-1)[0] d_0[1] d_1[1] ..    I*F_length bytes
+ *      ECF:    e_0[0] e_1[0] .. e_(I-1)[0] e_0[1] e_1[1] ..    I*(nn-kk) bytes
+ *
+ * A burst of up to I*tt corrupted bytes hits at most tt symbols of each
+ * codeword, so it is corrected, where a single packet_t fails on a burst of
+ * more than tt bytes.
+ *
+ * The data part holds the message bytes in order, so a frame is filled with a
+ * single copy. Codewords are encoded and decoded in place on the interleaved
+ * layout, as codewords with a stride of I symbols (see rs_encode_strided()),
+ * so no de-interleaving buffers are needed.
+ *
+ * header[3] holds F_length, the # of data symbols per codeword (<= kk); as for
+ * packet_t, short frames are shortened codes. The data part of a frame is
+ * zero padded to a multiple of I bytes. The depth I is a parameter of the link
+ * (e.g. per virtual channel) and is not sent; neither is the padding, so the
+ * receiver of a frame transfer needs the message size as well to cut it off.
+ *
+ * Wire format: header, the I*F_length data bytes and the I*(nn-kk) ECF bytes.
+ */
+
+#define RS_MAX_DEPTH 8
+
+struct frame {
+
+    MSG_TYPE header[HEADER_SIZE];       // As for packet_t, header[3] = F_length per codeword
+    int depth;                          // Interleaving depth I, 1..RS_MAX_DEPTH
+    MSG_TYPE body[RS_MAX_DEPTH*nn];     // Data part followed by ECF part
+
+};
+
+typedef struct frame frame_t;
+
+struct frame_transfer {
+
+    frame_t * frames;
+    int size;
+    int depth;
+    int bytes;      // Message size without the padding of the last frame, 0 if unknown
+
+};
+
+typedef struct frame_transfer frame_transfer_t;
+
+// Start of the ECF part of a frame
+static inline MSG_TYPE * frame_ecf(frame_t * frame)
+{
+    return &(frame->body[frame->depth * frame->header[3]]);
+}
+
+// Encode the codewords of a frame in place, with codec rs. Returns -1 if the frame is invalid.
+static inline int rs_encode_frame(const rs_codec_t * rs, frame_t * frame)
+{
+    register int c;
+    MSG_TYPE * ecf = frame_ecf(frame);
+
+    if (rs->np != nn-kk || frame->depth < 1 || frame->depth > RS_MAX_DEPTH) return -1;
+
+    for (c = 0; c < frame->depth; c++)
+        if (rs_encode_strided(rs, &(frame->body[c]), frame->header[3], frame->depth, &ecf[c]) != 0)
+            return -1;
+
+    return 0;
+}
+
+/*
+ * Decode the depth interleaved codewords of F_length data symbols each in
+ * body[] in place, with codec rs. If status is not NULL, the status of
+ * codeword c is stored in status[c]; error locations are positions in the
+ * codeword, not in the frame. Returns the total # of corrected symbols, or -1
+ * if any codeword is uncorrectable (the others are still corrected).
+ */
+static inline int rs_decode_interleaved(const rs_codec_t * rs, MSG_TYPE * body, int F_length, int depth,
+                                        decode_status_t * status)
+{
+    register int c;
+    int r, count = 0;
+    decode_status_t st;
+    MSG_TYPE * ecf = &body[depth * F_length];
+
+    if (rs->np != nn-kk || depth < 1 || depth > RS_MAX_DEPTH) return -1;
+
+    for (c = 0; c < depth; c++)
+    {
+        r = rs_decode_strided(rs, &body[c], F_length, depth, &ecf[c],
+                              NULL, 0, (status != NULL) ? &status[c] : &st);
+
+        if (r < 0 || count < 0) count = -1;
+        else count += r;
+    }
+
+    return count;
+}
+
+// Decode the codewords of a frame in place, with codec rs, see rs_decode_interleaved().
+static inline int rs_decode_frame(const rs_codec_t * rs, frame_t * frame, decode_status_t * status)
+{
+    return rs_decode_interleaved(rs, frame->body, frame->header[3], frame->depth, status);
+}
+
+/*
+ * Decode a frame of depth codewords in wire format (see serialize_frame()) in
+ * place, in the size bytes at buf, e.g. a receive buffer; nothing is copied.
+ * Returns as rs_decode_interleaved(), or -1 if buf does not hold a whole frame.
+ */
+static inline int rs_decode_frame_wire(const rs_codec_t * rs, MSG_TYPE * buf, int size, int depth,
+                                       decode_status_t * status)
+{
+    if (size < HEADER_SIZE || depth < 1 || depth > RS_MAX_DEPTH) return -1;
+    if (buf[3] > kk || size < HEADER_SIZE + depth * (buf[3] + (nn-kk))) return -1;
+
+    return rs_decode_interleaved(rs, &buf[HEADER_SIZE], buf[3], depth, status);
+}
+
+// Versions of the above using the default codec
+static inline void encode_frame(frame_t * frame)
+{
+    rs_encode_frame(rs_default_codec(), frame);
+}
+
+static inline int decode_frame(frame_t * frame, decode_status_t * status)
+{
+    return rs_decode_frame(rs_default_codec(), frame, status);
+}
+
+static inline int decode_frame_wire(MSG_TYPE * buf, int size, int depth, decode_status_t * status)
+{
+    return rs_decode_frame_wire(rs_default_codec(), buf, size, depth, status);
+}
+
+// View of the data part of a frame (including any padding), see data_view_t
+static inline data_view_t frame_view(const frame_t * frame)
+{
+    data_view_t view = { frame->body, frame->depth * frame->header[3] };
+    return view;
+}
+
+/*
+ * Fill a frame of depth codewords with size <= depth*kk bytes of data, pad it
+ * and encode it.
+ */
+static inline void fill_frame(frame_t * frame, const MSG_TYPE * data, const int size, const int depth, const int seq)
+{
+    int F_length = (size + depth - 1) / depth;
+
+    write_header(frame->header, F_length, seq);
+    frame->depth = depth;
+
+    memcpy(frame->body, data, size * sizeof(MSG_TYPE));
+    memset(&(frame->body[size]), 0, (depth*F_length - size) * sizeof(MSG_TYPE));
+
+    encode_frame(frame);
+}
+
+// # of frames of depth codewords needed for a message of size bytes
+#define FRAME_TRANSFER_FRAMES(size, depth) ((size)/((depth)*kk) + ((size) % ((depth)*kk) != 0))
+
+/*
+ * Split a message over the frames at frames[], which must hold
+ * FRAME_TRANSFER_FRAMES(size, depth) frames of depth (1..RS_MAX_DEPTH)
+ * interleaved codewords, see fill_transfer().
+ */
+static inline frame_transfer_t fill_frame_transfer(frame_t * frames, const MSG_TYPE * data, const int size, int depth)
+{
+    register int i;
+    frame_transfer_t transfer;
+    int per_frame, F_size;
+
+    if (depth < 1) depth = 1;
+    if (depth > RS_MAX_DEPTH) depth = RS_MAX_DEPTH;
+
+    per_frame       = depth*kk;
+    transfer.depth  = depth;
+    transfer.size   = FRAME_TRANSFER_FRAMES(size, depth); // # of frames required to store message
+    transfer.bytes  = size;
+    transfer.frames = frames;
+
+    for (i = 0; i < transfer.size; i++)
+    {
+        F_size = (size - i*per_frame < per_frame) ? size - i*per_frame : per_frame;
+        fill_frame(&(transfer.frames[i]), &data[i*per_frame], F_size, depth, i);
+    }
+
+    return transfer;
+}
+
+#ifndef RS_NO_HEAP
+// fill_frame_transfer() into newly allocated frames; free transfer.frames when done.
+static inline frame_transfer_t gen_frame_transfer(const MSG_TYPE * data, const int size, int depth)
+{
+    if (depth < 1) depth = 1;
+    if (depth > RS_MAX_DEPTH) depth = RS_MAX_DEPTH;
+
+    return fill_frame_transfer(malloc(FRAME_TRANSFER_FRAMES(size, depth) * sizeof(frame_t)), data, size, depth);
+}
+#endif
+
+/*
+ * Decode all frames of a transfer and return the decoding statistics, per
+ * codeword. If status is not NULL, the status of codeword c of frame i is
+ * stored in status[i*depth + c].
+ */
+static inline transfer_stats_t decode_frame_transfer(frame_transfer_t * transfer, decode_status_t * status)
+{
+    register int i, c;
+    decode_status_t st[RS_MAX_DEPTH];
+    transfer_stats_t stats = { 0 };
+
+    for (i = 0; i < transfer->size; i++)
+    {
+        decode_status_t * fs = (status != NULL) ? &status[i*transfer->depth] : st;
+
+        decode_frame(&(transfer->frames[i]), fs);
+        for (c = 0; c < transfer->frames[i].depth; c++)
+            count_status(&stats, &fs[c]);
+    }
+
+    return stats;
+}
+
+#ifndef RS_NO_HEAP
+/*
+ * Decode a frame transfer and reassemble the message, see unpack_transfer().
+ * The allocated message includes the zero padding of the last frame to a
+ * multiple of depth bytes; if size is not NULL the message size without it,
+ * transfer->bytes, is stored in size (the padded size if bytes is 0).
+ */
+static inline MSG_TYPE * unpack_frame_transfer(frame_transfer_t * transfer, transfer_stats_t * stats, int * size)
+{
+    register int i, N = 0;
+    int F_size;
+
+    transfer_stats_t st = decode_frame_transfer(transfer, NULL);
+    if (stats != NULL) *stats = st;
+
+    // Determine message size
+    for (i = 0; i < transfer->size; i++)
+        N += transfer->frames[i].depth * transfer->frames[i].header[3];
+
+    MSG_TYPE * msg = malloc(N * sizeof(MSG_TYPE));
+
+    for (i = 0, N = 0; i < transfer->size; i++)
+    {
+        F_size = transfer->frames[i].depth * transfer->frames[i].header[3];
+        memcpy(&msg[N], transfer->frames[i].body, F_size * sizeof(MSG_TYPE));
+        N += F_size;
+    }
+
+    if (size != NULL) *size = (transfer->bytes > 0 && transfer->bytes <= N) ? transfer->bytes : N;
+
+    return msg;
+}
+#endif
+
+/*
+ * WIRE FORMAT
+ */
+
+static inline int frame_wire_size(const frame_t * frame)
+{
+    return HEADER_SIZE + frame->depth * (frame->header[3] + (nn-kk));
+}
+
+// Write a frame to buf, which must hold frame_wire_size() bytes. Returns the number of bytes written.
+static inline int serialize_frame(const frame_t * frame, MSG_TYPE * buf)
+{
+    int size = frame_wire_size(frame);
+
+    memcpy(buf, frame->header, HEADER_SIZE * sizeof(MSG_TYPE));
+    memcpy(&buf[HEADER_SIZE], frame->body, (size - HEADER_SIZE) * sizeof(MSG_TYPE));
+
+    return size;
+}
+
+/*
+ * Read a frame of depth codewords from the size bytes in buf. Returns the
+ * number of bytes read, or -1 if buf does not hold a whole frame or the frame
+ * length is over kk.
+ */
+static inline int deserialize_frame(frame_t * frame, const MSG_TYPE * buf, int size, int depth)
+{
+    int F_length, wire;
+
+    if (size < HEADER_SIZE || depth < 1 || depth > RS_MAX_DEPTH) return -1;
+
+    F_length = buf[3];
+    wire     = HEADER_SIZE + depth * (F_length + (nn-kk));
+    if (F_length > kk || size < wire) return -1;
+
+    memcpy(frame->header, buf, HEADER_SIZE * sizeof(MSG_TYPE));
+    memcpy(frame->body, &buf[HEADER_SIZE], (wire - HEADER_SIZE) * sizeof(MSG_TYPE));
+    frame->depth = depth;
+
+    return wire;
+}
+
+#endif //INTERLEAVE_H
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <math.h>
 #include <stdint.h>
+#include <string.h>
 
 /*
  * ----------FLEXIBLE TELECOMMAND DECODER (FTCD)----------
@@ -22,6 +23,7 @@
 #include "rs.h"
 #include "encoder.h"
 #include "decoder.h"
+#include "pipeline.h"
 
 
 int write_to_file(int count, MSG_TYPE write[], char const *fileName)
@@ -44,7 +46,7 @@ int main()
     MSG_TYPE msg_send[MSG_SIZE];
 
     /*
-     * Generate lookup tables needed for Reed Solomon encoding / decoding.
+     * Lookup tables needed for Reed Solomon encoding / decoding.
      * Additional information along with the parameters for encoding / decoding
      * are provided in rs.h.
      *
@@ -53,12 +55,13 @@ int main()
      * in order for them to work within the framework built for this project.
      *
      * Note: If this software is split up between 2 devices, they should both
-     * have the same global variables (from rs.h), and need generate_gf() +
-     * gen_poly() to have been called just once during system boot.
+     * use the same code parameters (from rs.h). The tables of the default
+     * codec are generated at compile time (rs_gen.c, RS_STATIC_TABLES); without
+     * those, generate_gf() + gen_poly() should be called just once during
+     * system boot. Codecs for other codes (rs_params_t) are obtained from
+     * rs_codec_get(), or set up with rs_init().
      */
 
-    generate_gf(); gen_poly();
-
     // Fill msg_send with something...
     for ( i = 0; i < MSG_SIZE; i++ )
     {
@@ -70,14 +73,22 @@ int main()
      * packets, and the size of that array.
      *
      * The data is split according to the size of each packet:
-     * Total size 255 bytes + 5 header;
+     * Total size 255 bytes + 7 header;
      * 255 = 223 data + 32 Error correction.
      *
      * Error correction field(s) will be filled with the parity bits
      * generated by the Reed Solomon code.
+     *
+     * The packets are taken from a static packet pool (see transfer.h), so
+     * that nothing is allocated; gen_transfer() does the same with malloc().
      */
 
-    transfer_t transfer = gen_transfer(msg_send, MSG_SIZE);
+    static packet_t packs[TRANSFER_PACKETS(MSG_SIZE)];
+    packet_pool_t packet_pool;
+    packet_pool_init_static(&packet_pool, packs, TRANSFER_PACKETS(MSG_SIZE));
+
+    transfer_t transfer;
+    packet_pool_transfer(&packet_pool, &transfer, msg_send, MSG_SIZE);
 
     printf("ORIGINAL MESSAGE\n");
     print_transfer(&transfer);
@@ -99,21 +110,52 @@ int main()
      * And here.
      */
 
-    decode_transfer(&transfer); // Redundant: this is done in unpack_transfer too
+    /*
+     * Decode the packets on a pipeline of decoder threads (see pipeline.h):
+     * packets are submitted as they are received, and their results are
+     * polled and placed in the message (see reassembly in transfer.h) while
+     * later packets are still being decoded.
+     */
+    pipeline_t pipeline;
+    pipeline_result_t result;
+    pipeline_init(&pipeline, 4, 64);
+
+    MSG_TYPE msg_recv[MSG_SIZE];
+    static _Atomic unsigned int received[REASSEMBLY_WORDS(MSG_SIZE)];
+    reassembly_t reassembly;
+    reassembly_init_static(&reassembly, msg_recv, MSG_SIZE, received);
+
+    int polled, submitted;
+    for (i = 0, polled = 0; polled < transfer.size; )
+    {
+        // Submit the next packet received; if the pipeline is full, or all are in, wait for a result
+        submitted = i < transfer.size && pipeline_submit(&pipeline, &(transfer.packs[i])) == 0;
+        if (submitted) i++;
+
+        if (submitted ? pipeline_poll(&pipeline, &result) : pipeline_poll_wait(&pipeline, &result))
+        {
+            if (result.status.success)
+                reassembly_place(&reassembly, result.packet.header, result.packet.data);
+            transfer.packs[polled++] = result.packet;     // In the order submitted, for print_transfer()
+        }
+    }
+
+    transfer_stats_t stats = pipeline.stats;
+    pipeline_free(&pipeline);
 
     printf("DECODED MESSAGE\n");
     print_transfer(&transfer);
+    printf("%d packet(s): %d clean, %d corrected (%d symbols), %d uncorrectable, %s\n",
+           stats.packets, stats.clean, stats.corrected, stats.symbols, stats.uncorrectable,
+           reassembly_complete(&reassembly) ? "message complete" : "message incomplete");
     //write_to_file(MSG_SIZE, transfer.packs[0].data, "DECODED_MESSAGE.csv");
 
-    MSG_TYPE * msg_recv = unpack_transfer(&transfer);
-
     // Print data for check
     //printf("i \t\t msg_send[i] \t\t msg_recv[i]\n");
     //for (i = 0; i < MSG_SIZE; i++) printf("%3d \t\t %-11d \t\t %-11d\n", i, msg_send[i], msg_recv[i]);
 
-    // Free memory - PAY ATTENTION TO THIS WHEN PORTING TO AN EMBEDDED CHIP
-    free(msg_recv);
-    free(transfer.packs);
+    // Nothing to free: give the packets back to the pool so they can be reused
+    packet_pool_reset(&packet_pool);
 
     printf("sizeof(packet_t)   = %d\n", (int)sizeof(packet_t));
     printf("sizeof(transfer_t)   = %d\n", (int)sizeof(transfer_t));
@@ -0,0 +1,350 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "encoder.h"
+#include "decoder.h"
+
+/*
+ * ----------PARALLEL TRANSFER ENGINE----------
+ *
+ * Encodes or decodes the packets of a transfer on a pool of worker threads.
+ * Packets are independent and encode_rs() / decode_rs() only read the
+ * (default) codec, so any packet can be processed by any thread. Any other
+ * job made of n independent tasks can be run with thread_pool_run().
+ *
+ * Scheduling is done by work stealing: every worker starts with an equal,
+ * contiguous range of packets and takes packets off the front of its own
+ * range. A worker that runs out steals the back half of the range of another
+ * worker, so that a worker that is held up by slow packets (e.g. many errors)
+ * or by the OS is relieved by the others.
+ *
+ * A range [begin, end) is stored in a single 64-bit word, (end << 32) | begin,
+ * so that both the owner and the thieves update it with a single
+ * compare-and-swap.
+ *
+ * Usage:
+ *      thread_pool_t pool;
+ *      thread_pool_init(&pool, 8);
+ *      encode_transfer_mt(&pool, &transfer);
+ *      stats = decode_transfer_mt(&pool, &transfer, NULL);
+ *      stats = reassemble_transfer_mt(&pool, &reassembly, packs, n);
+ *      stats = thread_pool_run(&pool, n, task, arg);
+ *      thread_pool_free(&pool);
+ */
+
+#define POOL_MAX_THREADS 256
+
+#define RANGE(begin, end)   (((unsigned long long) (end) << 32) | (unsigned int) (begin))
+#define RANGE_BEGIN(r)      ((int) ((r) & 0xFFFFFFFFu))
+#define RANGE_END(r)        ((int) ((r) >> 32))
+
+struct pool_worker {
+
+    _Alignas(64) _Atomic unsigned long long range;   // Packets left to this worker
+    transfer_stats_t stats;                          // Statistics of the tasks run by this worker
+
+    struct thread_pool * pool;
+    int id;
+
+};
+
+typedef struct pool_worker pool_worker_t;
+
+/*
+ * Task i of a job: processes e.g. packet i, and counts its decoding results
+ * in stats, which belong to the worker running the task.
+ */
+typedef void (* pool_task_t)(void * arg, int i, transfer_stats_t * stats);
+
+struct thread_pool {
+
+    int threads;                // # of worker threads
+    pthread_t * tids;
+    pool_worker_t * workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;       // Signalled when a job is posted
+    pthread_cond_t done;        // Signalled when the last worker finishes a job
+    unsigned int job;           // Job counter, incremented for every job
+    int busy;                   // # of workers still working on the current job
+    int quit;
+
+    // Current job
+    pool_task_t task;
+    void * arg;
+
+};
+
+typedef struct thread_pool thread_pool_t;
+
+// Take the next packet off the front of a worker's own range, -1 if empty.
+static inline int pool_pop(pool_worker_t * w)
+{
+    unsigned long long r = atomic_load(&w->range);
+
+    while (RANGE_BEGIN(r) < RANGE_END(r))
+        if (atomic_compare_exchange_weak(&w->range, &r, RANGE(RANGE_BEGIN(r)+1, RANGE_END(r))))
+            return RANGE_BEGIN(r);
+
+    return -1;
+}
+
+// Steal the back half of the range of another worker, 0 if there was nothing left to steal.
+static inline int pool_steal(pool_worker_t * w)
+{
+    thread_pool_t * pool = w->pool;
+    register int i;
+    unsigned long long r;
+    int begin, end, mid;
+
+    for (i = 1; i < pool->threads; i++)
+    {
+        pool_worker_t * victim = &(pool->workers[(w->id + i) % pool->threads]);
+
+        r = atomic_load(&victim->range);
+        for (;;)
+        {
+            begin = RANGE_BEGIN(r); end = RANGE_END(r);
+            if (end - begin < 2) break; // Leave the last packet to its owner
+
+            mid = begin + (end - begin)/2;
+            if (atomic_compare_exchange_weak(&victim->range, &r, RANGE(begin, mid)))
+            {
+                // Own range is empty, so nobody else is updating it
+                atomic_store(&w->range, RANGE(mid, end));
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static inline void pool_run(pool_worker_t * w)
+{
+    thread_pool_t * pool = w->pool;
+    int i;
+
+    do {
+        while ((i = pool_pop(w)) >= 0)
+            pool->task(pool->arg, i, &(w->stats));
+    } while (pool_steal(w));
+}
+
+static inline void * pool_thread(void * arg)
+{
+    pool_worker_t * w = (pool_worker_t *) arg;
+    thread_pool_t * pool = w->pool;
+    unsigned int job = 0;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->job == job && !pool->quit)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->quit)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        job = pool->job;
+        pthread_mutex_unlock(&pool->lock);
+
+        pool_run(w);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0)
+            pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static inline void thread_pool_free(thread_pool_t * pool)
+{
+    register int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->threads; i++)
+        pthread_join(pool->tids[i], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+
+    free(pool->tids);
+    free(pool->workers);
+}
+
+/*
+ * Start a pool of threads worker threads. Returns 0 on success, -1 on failure.
+ */
+static inline int thread_pool_init(thread_pool_t * pool, int threads)
+{
+    register int i;
+
+    if (threads < 1) threads = 1;
+    if (threads > POOL_MAX_THREADS) threads = POOL_MAX_THREADS;
+
+    pool->threads = threads;
+    pool->tids    = malloc(threads * sizeof(pthread_t));
+    pool->workers = aligned_alloc(64, threads * sizeof(pool_worker_t));
+    pool->job     = 0;
+    pool->busy    = 0;
+    pool->quit    = 0;
+
+    if (pool->tids == NULL || pool->workers == NULL)
+    {
+        free(pool->tids); free(pool->workers);
+        return -1;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (i = 0; i < threads; i++)
+    {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id   = i;
+        atomic_init(&pool->workers[i].range, RANGE(0, 0));
+
+        if (pthread_create(&pool->tids[i], NULL, pool_thread, &pool->workers[i]) != 0)
+        {
+            pool->threads = i;
+            thread_pool_free(pool);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Run task(arg, i, stats) for i = 0..n-1 on the pool and wait for all tasks to
+ * finish. The tasks are split over the workers and may run in any order.
+ * Returns the statistics counted by the tasks.
+ */
+static inline transfer_stats_t thread_pool_run(thread_pool_t * pool, int n, pool_task_t task, void * arg)
+{
+    register int i;
+    transfer_stats_t stats = { 0 };
+
+    pthread_mutex_lock(&pool->lock);
+
+    pool->task = task;
+    pool->arg  = arg;
+
+    for (i = 0; i < pool->threads; i++)
+    {
+        transfer_stats_t none = { 0 };
+        pool->workers[i].stats = none;
+        atomic_store(&pool->workers[i].range,
+                     RANGE((long long) n*i/pool->threads, (long long) n*(i+1)/pool->threads));
+    }
+
+    pool->busy = pool->threads;
+    pool->job++;
+    pthread_cond_broadcast(&pool->start);
+
+    while (pool->busy > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->threads; i++)
+        merge_stats(&stats, &(pool->workers[i].stats));
+
+    return stats;
+}
+
+struct transfer_job {
+
+    transfer_t * transfer;
+    decode_status_t * status;
+
+};
+
+struct reassembly_job {
+
+    reassembly_t * r;
+    packet_t * packs;
+
+};
+
+// Task i encodes the ENCODE_BATCH packets from i*ENCODE_BATCH on, as one batch
+static inline void pool_encode_batch(void * arg, int i, transfer_stats_t * stats)
+{
+    struct transfer_job * job = (struct transfer_job *) arg;
+    int first = i * ENCODE_BATCH, n = job->transfer->size - first;
+
+    (void) stats;
+    encode_packets(&(job->transfer->packs[first]), (n < ENCODE_BATCH) ? n : ENCODE_BATCH);
+}
+
+static inline void pool_decode_packet(void * arg, int i, transfer_stats_t * stats)
+{
+    struct transfer_job * job = (struct transfer_job *) arg;
+    decode_status_t st;
+
+    decode_rs(&(job->transfer->packs[i]), &st);
+    count_status(stats, &st);
+    if (job->status != NULL) job->status[i] = st;
+}
+
+static inline void pool_reassemble_packet(void * arg, int i, transfer_stats_t * stats)
+{
+    struct reassembly_job * job = (struct reassembly_job *) arg;
+    decode_status_t st;
+
+    reassembly_add(job->r, &(job->packs[i]), &st);
+    count_status(stats, &st);
+}
+
+// Parallel version of encode_transfer()
+static inline void encode_transfer_mt(thread_pool_t * pool, transfer_t * transfer)
+{
+    struct transfer_job job = { transfer, NULL };
+
+    RS_PROF_START(t);
+    thread_pool_run(pool, (transfer->size + ENCODE_BATCH-1) / ENCODE_BATCH, pool_encode_batch, &job);
+    RS_PROF_LAP(RS_STAGE_TRANSFER_ENCODE, t);
+}
+
+// Parallel version of decode_transfer()
+static inline transfer_stats_t decode_transfer_mt(thread_pool_t * pool, transfer_t * transfer, decode_status_t * status)
+{
+    struct transfer_job job = { transfer, status };
+    transfer_stats_t stats;
+
+    RS_PROF_START(t);
+    stats = thread_pool_run(pool, transfer->size, pool_decode_packet, &job);
+    RS_PROF_LAP(RS_STAGE_TRANSFER_DECODE, t);
+
+    return stats;
+}
+
+/*
+ * Decode n packets, received in any order, and place their data in the
+ * reassembly r (see transfer.h), which may also be fed by other threads at
+ * the same time. Returns the decoding statistics of the packets.
+ */
+static inline transfer_stats_t reassemble_transfer_mt(thread_pool_t * pool, reassembly_t * r, packet_t * packs, int n)
+{
+    struct reassembly_job job = { r, packs };
+    transfer_stats_t stats;
+
+    RS_PROF_START(t);
+    stats = thread_pool_run(pool, n, pool_reassemble_packet, &job);
+    RS_PROF_LAP(RS_STAGE_TRANSFER_DECODE, t);
+
+    return stats;
+}
+
+#endif //PARALLEL_H
@@ -0,0 +1,325 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "encoder.h"
+#include "decoder.h"
+
+/*
+ * ----------DECODE PIPELINE----------
+ *
+ * Decodes packets asynchronously, so that receiving, decoding and delivering
+ * overlap: a receiving thread hands packets in with pipeline_submit() as they
+ * arrive, decoder threads decode them in the background, and a delivering
+ * thread (possibly the same as the receiving one) takes the results out with
+ * pipeline_poll(), in the order the packets were submitted.
+ *
+ * Every decoder thread has a lane: a ring of depth slots (a power of two)
+ * that each hold a packet and its decoding status, and three counters, of
+ * the packets submitted, decoded and polled. Each counter is written by one
+ * thread only and read by the next one, so a lane is a lock-free
+ * single-producer/single-consumer ring twice over, submitter -> decoder ->
+ * poller, and a packet is decoded in its slot without being copied between
+ * queues. Packets are dealt out to the lanes in turn and polled from them in
+ * the same turn, which keeps them in order.
+ *
+ * Backpressure: pipeline_submit() fails (returns -1) while the next lane is
+ * full of packets that have not been polled yet. The submitter should then
+ * poll (pipeline_poll_wait()), or wait for the poller, and submit again,
+ * rather than queue more packets. As at most depth packets wait in a lane,
+ * and decode_rs() takes a bounded time per packet (at most tt errors are
+ * searched for), the latency of a packet stays bounded under bursts: at most
+ * depth decodes of its lane after it was submitted.
+ *
+ * A decoder thread that runs out of packets spins for PIPELINE_SPIN rounds,
+ * so that it picks up the next packet of a burst at once, and then sleeps
+ * until pipeline_submit() wakes it. After the first PIPELINE_PAUSE rounds it
+ * yields the CPU in every round, so that spinning does not hold up the
+ * submitter or the poller when there are fewer cores than threads.
+ *
+ * Usage:
+ *      pipeline_init(&pipeline, 4, 64);
+ *      pipeline_submit(&pipeline, &packet);            // 0, or -1 if full: poll first
+ *      while (pipeline_poll(&pipeline, &result)) ...   // result.packet, result.status
+ *      while (pipeline_poll_wait(&pipeline, &result)) ...  // at the end: all results
+ *      pipeline_free(&pipeline);
+ *
+ * Only one thread may submit and only one thread may poll at a time.
+ */
+
+#define PIPELINE_MAX_THREADS 256
+#define PIPELINE_SPIN        4096   // Rounds a decoder thread spins for before it sleeps
+#define PIPELINE_PAUSE       64     // Rounds spent in a pause instruction rather than sched_yield()
+
+// A packet in the pipeline, decoded in place
+struct pipeline_result {
+
+    packet_t packet;
+    decode_status_t status;
+
+};
+
+typedef struct pipeline_result pipeline_result_t;
+
+struct pipeline_lane {
+
+    _Alignas(64) _Atomic unsigned int submitted;    // # of packets submitted to the lane, by the submitter
+    _Alignas(64) _Atomic unsigned int decoded;      // # of packets decoded, by the decoder thread
+    _Alignas(64) _Atomic unsigned int polled;       // # of packets polled, by the poller
+    _Alignas(64) _Atomic int sleeping;              // 1 while the decoder thread (may) wait for wake
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+
+    pipeline_result_t * slots;                      // Packet i is in slots[i & mask]
+    struct pipeline * pipeline;
+
+};
+
+typedef struct pipeline_lane pipeline_lane_t;
+
+struct pipeline {
+
+    int threads;                // # of decoder threads, and lanes
+    unsigned int depth;         // # of slots per lane, a power of two
+    unsigned int mask;          // depth - 1
+    pthread_t * tids;
+    pipeline_lane_t * lanes;
+    _Atomic int quit;
+
+    unsigned int next_submit;   // Lane of the next packet submitted, by the submitter
+    unsigned int next_poll;     // Lane of the next packet polled, by the poller
+    transfer_stats_t stats;     // Statistics of the packets polled, by the poller
+
+};
+
+typedef struct pipeline pipeline_t;
+
+// Round spins of a thread waiting for another one
+static inline void pipeline_pause(int spins)
+{
+    if (spins > PIPELINE_PAUSE)
+        sched_yield();
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    else
+        __builtin_ia32_pause();
+#endif
+}
+
+static inline void * pipeline_thread(void * arg)
+{
+    pipeline_lane_t * lane = (pipeline_lane_t *) arg;
+    pipeline_t * p = lane->pipeline;
+    pipeline_result_t * slot;
+    unsigned int next;
+    int spins = 0;
+
+    for (;;)
+    {
+        next = atomic_load_explicit(&lane->decoded, memory_order_relaxed);
+
+        if (next != atomic_load_explicit(&lane->submitted, memory_order_acquire))
+        {
+            slot = &(lane->slots[next & p->mask]);
+            decode_rs(&(slot->packet), &(slot->status));
+            atomic_store_explicit(&lane->decoded, next + 1, memory_order_release);
+            spins = 0;
+        }
+        else if (atomic_load_explicit(&p->quit, memory_order_relaxed))
+            return NULL;
+        else if (++spins < PIPELINE_SPIN)
+            pipeline_pause(spins);
+        else
+        {
+            /*
+             * Sleep. sleeping is set before submitted is checked again, and
+             * pipeline_submit() sets submitted before it checks sleeping
+             * (both sequentially consistent), so either this thread sees the
+             * new packet or the submitter sees it sleeping and wakes it.
+             */
+            pthread_mutex_lock(&lane->lock);
+            atomic_store(&lane->sleeping, 1);
+            while (next == atomic_load(&lane->submitted) && !atomic_load(&p->quit))
+                pthread_cond_wait(&lane->wake, &lane->lock);
+            atomic_store(&lane->sleeping, 0);
+            pthread_mutex_unlock(&lane->lock);
+            spins = 0;
+        }
+    }
+}
+
+static inline void pipeline_wake(pipeline_lane_t * lane)
+{
+    pthread_mutex_lock(&lane->lock);
+    pthread_cond_signal(&lane->wake);
+    pthread_mutex_unlock(&lane->lock);
+}
+
+/*
+ * Stop the decoder threads, once they have decoded the packets submitted, and
+ * free the pipeline. Results not polled are dropped.
+ */
+static inline void pipeline_free(pipeline_t * p)
+{
+    register int i;
+
+    atomic_store(&p->quit, 1);
+    for (i = 0; i < p->threads; i++)
+    {
+        pipeline_wake(&p->lanes[i]);
+        pthread_join(p->tids[i], NULL);
+
+        pthread_mutex_destroy(&p->lanes[i].lock);
+        pthread_cond_destroy(&p->lanes[i].wake);
+        free(p->lanes[i].slots);
+    }
+
+    free(p->tids);
+    free(p->lanes);
+}
+
+/*
+ * Start a pipeline of threads decoder threads, each with a lane of depth
+ * slots (rounded up to a power of two). Returns 0 on success, -1 on failure.
+ */
+static inline int pipeline_init(pipeline_t * p, int threads, int depth)
+{
+    register int i;
+    transfer_stats_t none = { 0 };
+
+    if (threads < 1) threads = 1;
+    if (threads > PIPELINE_MAX_THREADS) threads = PIPELINE_MAX_THREADS;
+
+    for (p->depth = 1; p->depth < (unsigned int) depth && p->depth < (1u << 30); p->depth <<= 1) ;
+
+    p->mask        = p->depth - 1;
+    p->threads     = 0;
+    p->tids        = malloc(threads * sizeof(pthread_t));
+    p->lanes       = aligned_alloc(64, threads * sizeof(pipeline_lane_t));
+    p->next_submit = 0;
+    p->next_poll   = 0;
+    p->stats       = none;
+    atomic_init(&p->quit, 0);
+
+    if (p->tids == NULL || p->lanes == NULL)
+    {
+        free(p->tids); free(p->lanes);
+        return -1;
+    }
+
+    for (i = 0; i < threads; i++)
+    {
+        pipeline_lane_t * lane = &(p->lanes[i]);
+
+        atomic_init(&lane->submitted, 0);
+        atomic_init(&lane->decoded, 0);
+        atomic_init(&lane->polled, 0);
+        atomic_init(&lane->sleeping, 0);
+        pthread_mutex_init(&lane->lock, NULL);
+        pthread_cond_init(&lane->wake, NULL);
+        lane->pipeline = p;
+        lane->slots    = malloc(p->depth * sizeof(pipeline_result_t));
+
+        if (lane->slots == NULL || pthread_create(&p->tids[i], NULL, pipeline_thread, lane) != 0)
+        {
+            pthread_mutex_destroy(&lane->lock);
+            pthread_cond_destroy(&lane->wake);
+            free(lane->slots);
+            pipeline_free(p);
+            return -1;
+        }
+
+        p->threads = i + 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Submit a packet to be decoded; it is copied into the pipeline. Returns 0,
+ * or -1 if the pipeline is full (see backpressure above).
+ */
+static inline int pipeline_submit(pipeline_t * p, const packet_t * packet)
+{
+    pipeline_lane_t * lane = &(p->lanes[p->next_submit]);
+    unsigned int next = atomic_load_explicit(&lane->submitted, memory_order_relaxed);
+
+    if (next - atomic_load_explicit(&lane->polled, memory_order_acquire) == p->depth)
+        return -1;
+
+    lane->slots[next & p->mask].packet = *packet;
+    atomic_store(&lane->submitted, next + 1);           // Sequentially consistent, see pipeline_thread()
+
+    if (atomic_load(&lane->sleeping))
+        pipeline_wake(lane);
+
+    if (++p->next_submit == (unsigned int) p->threads)
+        p->next_submit = 0;
+
+    return 0;
+}
+
+/*
+ * Take the next result out of the pipeline, in the order the packets were
+ * submitted, and count it in p->stats. Returns 1 if a result was stored in
+ * result, 0 if the next packet has not been decoded yet.
+ */
+static inline int pipeline_poll(pipeline_t * p, pipeline_result_t * result)
+{
+    pipeline_lane_t * lane = &(p->lanes[p->next_poll]);
+    unsigned int next = atomic_load_explicit(&lane->polled, memory_order_relaxed);
+
+    if (next == atomic_load_explicit(&lane->decoded, memory_order_acquire))
+        return 0;
+
+    *result = lane->slots[next & p->mask];
+    atomic_store_explicit(&lane->polled, next + 1, memory_order_release);
+    count_status(&(p->stats), &(result->status));
+
+    if (++p->next_poll == (unsigned int) p->threads)
+        p->next_poll = 0;
+
+    return 1;
+}
+
+/*
+ * pipeline_poll(), but wait for the next result if there is a packet pending,
+ * e.g. when pipeline_submit() has failed. Waiting spins as the decoder
+ * threads do, yielding the CPU to them. Returns 0 only if no packet is
+ * pending.
+ */
+static inline int pipeline_poll_wait(pipeline_t * p, pipeline_result_t * result)
+{
+    pipeline_lane_t * lane = &(p->lanes[p->next_poll]);
+    int spins = 0;
+
+    while (!pipeline_poll(p, result))
+    {
+        // The next packet submitted after the last one polled would be in this lane
+        if (atomic_load_explicit(&lane->submitted, memory_order_relaxed) ==
+            atomic_load_explicit(&lane->polled, memory_order_relaxed))
+            return 0;
+
+        pipeline_pause(++spins);
+    }
+
+    return 1;
+}
+
+// # of packets submitted and not polled yet; read by the submitter or the poller
+static inline int pipeline_pending(pipeline_t * p)
+{
+    register int i;
+    int n = 0;
+
+    for (i = 0; i < p->threads; i++)
+        n += (int) (atomic_load_explicit(&p->lanes[i].submitted, memory_order_acquire) -
+                    atomic_load_explicit(&p->lanes[i].polled, memory_order_acquire));
+
+    return n;
+}
+
+#endif //PIPELINE_H
@@ -0,0 +1,225 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "rs.h"
+
+/*
+ * ----------CODEC PROFILE----------
+ *
+ * With RS_PROFILE defined, the encoder, the stages of the decoder and the
+ * transfer functions count their calls and the cycles spent in them, and the
+ * decoder keeps a histogram of the # of corrected symbols per codeword:
+ *
+ *      encode              parity generation (rs_encode_buf() and friends)
+ *      syndromes           syndrome computation of a received word
+ *      locator             erasure locator and Berlekamp-Massey
+ *      chien               roots of the errata locator
+ *      forney              errata values
+ *      correct             correcting the received word in place
+ *      transfer_encode     fill_transfer(), encode_transfer_mt()
+ *      transfer_decode     decode_transfer(), decode_transfer_mt(), incl. the
+ *                          stages above
+ *
+ * A stage is only counted when it is reached: a clean word takes the
+ * syndromes stage only, and an uncorrectable one stops at the stage that
+ * rejects it. Cycles are TSC cycles on x86 and nanoseconds elsewhere.
+ *
+ * Every thread counts into counters of its own, on cache lines of their own,
+ * so that threads decoding at once do not contend for them and skew what is
+ * measured: counting costs a few uncontended atomic additions per codeword.
+ * The first RS_PROFILE_THREADS threads that count get their own counters;
+ * later threads share them in turn. rs_profile_snapshot() adds up the
+ * counters of all threads into an rs_profile_t, which rs_profile_json()
+ * formats as JSON, e.g. for a monitoring endpoint.
+ *
+ * Without RS_PROFILE, the counting macros below are empty and the codec is
+ * compiled exactly as before; the snapshot is then all zeros.
+ */
+
+enum rs_stage {
+
+    RS_STAGE_ENCODE,
+    RS_STAGE_SYNDROMES,
+    RS_STAGE_LOCATOR,
+    RS_STAGE_CHIEN,
+    RS_STAGE_FORNEY,
+    RS_STAGE_CORRECT,
+    RS_STAGE_TRANSFER_ENCODE,
+    RS_STAGE_TRANSFER_DECODE,
+    RS_STAGES
+
+};
+
+static const char * const rs_stage_names[RS_STAGES] = {
+        "encode", "syndromes", "locator", "chien", "forney", "correct", "transfer_encode", "transfer_decode"
+};
+
+struct rs_profile {
+
+    unsigned long long calls[RS_STAGES];
+    unsigned long long cycles[RS_STAGES];
+    unsigned long long errata[RS_MAX_ROOTS+1];  // # of codewords decoded with i corrected symbols
+    unsigned long long uncorrectable;           // # of codewords that could not be corrected
+
+};
+
+typedef struct rs_profile rs_profile_t;
+
+#ifdef RS_PROFILE
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+#define RS_PROFILE_THREADS 64   // # of threads with counters of their own
+
+struct rs_prof_counters {
+
+    _Alignas(64) _Atomic unsigned long long calls[RS_STAGES];
+    _Atomic unsigned long long cycles[RS_STAGES];
+    _Atomic unsigned long long errata[RS_MAX_ROOTS+1];
+    _Atomic unsigned long long uncorrectable;
+
+};
+
+static struct rs_prof_counters rs_prof[RS_PROFILE_THREADS];
+static _Atomic unsigned int rs_prof_threads;                // # of threads that have counted
+static _Thread_local struct rs_prof_counters * rs_prof_mine; // Counters of this thread
+
+static inline struct rs_prof_counters * rs_prof_counters()
+{
+    if (rs_prof_mine == NULL)
+        rs_prof_mine = &rs_prof[atomic_fetch_add_explicit(&rs_prof_threads, 1, memory_order_relaxed)
+                                % RS_PROFILE_THREADS];
+
+    return rs_prof_mine;
+}
+
+static inline unsigned long long rs_prof_clock()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return __rdtsc();
+#else
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+#endif
+}
+
+static inline void rs_prof_add(int stage, unsigned long long cycles)
+{
+    struct rs_prof_counters * c = rs_prof_counters();
+
+    atomic_fetch_add_explicit(&c->calls[stage], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&c->cycles[stage], cycles, memory_order_relaxed);
+}
+
+static inline void rs_prof_errata(int count)
+{
+    struct rs_prof_counters * c = rs_prof_counters();
+
+    if (count < 0)
+        atomic_fetch_add_explicit(&c->uncorrectable, 1, memory_order_relaxed);
+    else
+        atomic_fetch_add_explicit(&c->errata[count], 1, memory_order_relaxed);
+}
+
+// Start timing into t; RS_PROF_LAP() counts the time since then for stage and restarts t
+#define RS_PROF_START(t)        unsigned long long t = rs_prof_clock()
+#define RS_PROF_LAP(stage, t)   do { unsigned long long rs_prof_now_ = rs_prof_clock(); \
+                                     rs_prof_add((stage), rs_prof_now_ - (t)); \
+                                     (t) = rs_prof_now_; } while (0)
+// Count a decoded codeword with count corrected symbols, or an uncorrectable one if count < 0
+#define RS_PROF_ERRATA(count)   rs_prof_errata(count)
+
+#else
+
+#define RS_PROF_START(t)
+#define RS_PROF_LAP(stage, t)
+#define RS_PROF_ERRATA(count)
+
+#endif
+
+// Add up the counters of all threads into prof
+static inline void rs_profile_snapshot(rs_profile_t * prof)
+{
+    memset(prof, 0, sizeof(rs_profile_t));
+#ifdef RS_PROFILE
+    register int i, t;
+    struct rs_prof_counters * c;
+
+    for (t = 0; t < RS_PROFILE_THREADS; t++)
+    {
+        c = &rs_prof[t];
+
+        for (i = 0; i < RS_STAGES; i++)
+        {
+            prof->calls[i]  += atomic_load_explicit(&c->calls[i], memory_order_relaxed);
+            prof->cycles[i] += atomic_load_explicit(&c->cycles[i], memory_order_relaxed);
+        }
+        for (i = 0; i <= RS_MAX_ROOTS; i++)
+            prof->errata[i] += atomic_load_explicit(&c->errata[i], memory_order_relaxed);
+        prof->uncorrectable += atomic_load_explicit(&c->uncorrectable, memory_order_relaxed);
+    }
+#endif
+}
+
+// Set all counters to zero, e.g. at the start of a measurement interval
+static inline void rs_profile_reset()
+{
+#ifdef RS_PROFILE
+    register int i, t;
+    struct rs_prof_counters * c;
+
+    for (t = 0; t < RS_PROFILE_THREADS; t++)
+    {
+        c = &rs_prof[t];
+
+        for (i = 0; i < RS_STAGES; i++)
+        {
+            atomic_store_explicit(&c->calls[i], 0, memory_order_relaxed);
+            atomic_store_explicit(&c->cycles[i], 0, memory_order_relaxed);
+        }
+        for (i = 0; i <= RS_MAX_ROOTS; i++)
+            atomic_store_explicit(&c->errata[i], 0, memory_order_relaxed);
+        atomic_store_explicit(&c->uncorrectable, 0, memory_order_relaxed);
+    }
+#endif
+}
+
+/*
+ * Format prof as JSON into buf, which holds size bytes:
+ *      {"stages":{"encode":{"calls":..,"cycles":..},..},"errata":[..],"uncorrectable":..}
+ * errata[i] is the # of codewords with i corrected symbols, up to the highest
+ * nonzero entry. Returns the length of the JSON text; as for snprintf(), the
+ * text is truncated if that is size or more.
+ */
+static inline int rs_profile_json(const rs_profile_t * prof, char * buf, int size)
+{
+    register int i;
+    int n = 0, last = 0;
+
+#define RS_PROF_PRINT(...) (n += snprintf((n < size) ? &buf[n] : NULL, (n < size) ? (size_t) (size - n) : 0, __VA_ARGS__))
+
+    RS_PROF_PRINT("{\"stages\":{");
+    for (i = 0; i < RS_STAGES; i++)
+        RS_PROF_PRINT("%s\"%s\":{\"calls\":%llu,\"cycles\":%llu}", (i > 0) ? "," : "", rs_stage_names[i],
+                      prof->calls[i], prof->cycles[i]);
+
+    for (i = 0; i <= RS_MAX_ROOTS; i++)
+        if (prof->errata[i] != 0) last = i;
+
+    RS_PROF_PRINT("},\"errata\":[");
+    for (i = 0; i <= last; i++)
+        RS_PROF_PRINT("%s%llu", (i > 0) ? "," : "", prof->errata[i]);
+    RS_PROF_PRINT("],\"uncorrectable\":%llu}", prof->uncorrectable);
+
+#undef RS_PROF_PRINT
+
+    return n;
+}
+
+#endif //PROFILE_H
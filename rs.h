@@ -51,6 +51,12 @@
 /*
  * NOTE: encode_rs() and decode_rs() have been split into two header files
  * because the target devices need separate compilation.
+ *
+ * NOTE: erasures are handled by decode_rs_erasures() in decoder.h.
+ *
+ * NOTE: mm, nn, tt and kk are the parameters of the default code, which also
+ * fix the layout of packet_t (transfer.h). Other codes are configured at
+ * runtime with an rs_params_t, see rs_codec_get().
  */
 
 #define mm  8       /* RS code over GF(2**8) - change to suit */
@@ -58,66 +64,471 @@
 #define tt  16      /* number of errors that can be corrected */
 #define kk  223     /* kk = nn-2*tt  */
 
+#include <stdatomic.h>
+
+/*
+ * ----------CODE PARAMETERS----------
+ *
+ * A code is given by its symbol size m, the primitive polynomial p(X) that
+ * generates GF(2**m), its length n and dimension k, and the roots of its
+ * generator polynomial,
+ *      g(X) = prod (X + alpha**(prim*(fcr+i))),  i=0..n-k-1
+ * A code with n < 2**m-1 is a shortened code: the missing leading data
+ * symbols are taken to be zero and are not transmitted. Up to t=(n-k)/2
+ * errors can be corrected.
+ *
+ * Symbols are stored in bytes, so m <= RS_MAX_MM, and the tables of a codec
+ * are sized for at most RS_MAX_ROOTS parity symbols.
+ */
+
+#define RS_MAX_MM       8
+#define RS_MAX_NN       ((1<<RS_MAX_MM)-1)
+
+#ifndef RS_MAX_ROOTS
+#define RS_MAX_ROOTS    64
+#endif
+
+struct rs_params {
+
+    int m;          // Symbol size in bits, 2..RS_MAX_MM
+    int poly;       // Primitive polynomial, bit i is the coefficient of X**i
+    int n;          // Codeword length in symbols, n <= 2**m-1
+    int k;          // # of data symbols, n-k <= RS_MAX_ROOTS parity symbols
+    int fcr;        // First consecutive root of g(X), index form
+    int prim;       // Primitive element used to generate the roots, index form
+
+};
+
+typedef struct rs_params rs_params_t;
+
+/* p(x) = 1+x^2+x^3+x^4+x^8, first root alpha**1 : Rockliff's code, used by packet_t */
+#define RS_PARAMS_DEFAULT       { mm, 0x11D, nn, kk, 1, 1 }
+
+/* CCSDS 131.0-B (conventional, not dual basis representation):
+   p(x) = 1+x+x^2+x^7+x^8, roots alpha**(11*j), j=128-t..127+t */
+#define RS_PARAMS_CCSDS_223     { 8, 0x187, 255, 223, 112, 11 }
+#define RS_PARAMS_CCSDS_239     { 8, 0x187, 255, 239, 120, 11 }
+
+/* DVB (ETSI EN 300 421): RS(255,239) shortened to RS(204,188), roots alpha**0..alpha**15 */
+#define RS_PARAMS_DVB           { 8, 0x11D, 204, 188, 0, 1 }
+
+/*
+ * NOTE: packet_t carries exactly nn-kk = 32 ECF symbols, and everything built
+ * on it takes that layout: rs_encode(), rs_encode_packets(), rs_decode(),
+ * rs_decode_erasures() and rs_decode_wire() return -1 for a codec with
+ * another number of parity symbols, and so do the transfers, frames,
+ * streams, packet pool and pipeline. Codes such as RS_PARAMS_CCSDS_239 and
+ * RS_PARAMS_DVB (16 parity symbols) are only usable through the buffer API,
+ * rs_encode_buf() and rs_decode_buf(), on caller laid out codewords.
+ */
+
+static const rs_params_t rs_default_params = RS_PARAMS_DEFAULT ;
+
+/* Functions that are specialised by calling them with constant arguments (see
+   RS_FIXED_ENCODER and RS_FIXED_DECODER) must be inlined into their callers */
+#ifdef __GNUC__
+#define RS_INLINE __attribute__((always_inline)) inline
+#else
+#define RS_INLINE inline
+#endif
+
+/*
+ * ----------CODEC CONTEXT----------
+ *
+ * All lookup tables of a code are held in an rs_codec_t, rather than in global
+ * variables, and every encode/decode function takes the codec it should use.
+ * A codec is only written by rs_init() (or generate_gf() + gen_poly() for the
+ * default codec); after that it is read-only, so a single codec can be shared
+ * by any number of threads. The received codeword is not copied into a
+ * buffer but decoded in place, so there is no other state.
+ *
+ * Every function in these headers is static inline and every variable static,
+ * so that they can be included in several translation units (e.g. an encoder
+ * and a decoder built for separate target devices). Each translation unit
+ * then has its own default codec and codec cache.
+ *
+ * A codec takes ~75 kB, so it should be allocated statically or on the heap
+ * rather than on the stack; rs_codec_get() does the latter.
+ */
+
+struct rs_codec {
+
+    rs_params_t par;
+    int q;          // 2**m-1, the modulus of index form arithmetic
+    int np;         // n-k, # of parity symbols (and of syndromes)
+    int t;          // (n-k)/2, # of errors that can be corrected
+    int iprim;      // prim**-1 modulo q: the errata at X = alpha**i is at position i*iprim
+
+    /*
+     * Field tables: alpha_to[i] = alpha**i for i=0..2q-1, so that the sum of two
+     * indices never needs a reduction modulo q, and index_of[x] = log x with
+     * index_of[0] = -1. gg[] is the generator polynomial in index form (-1 for
+     * zero coefficients); these two keep Rockliff's -1 convention and are only
+     * used off the hot paths.
+     */
+    unsigned char alpha_to[2*RS_MAX_NN];
+    short index_of[RS_MAX_NN+1], gg[RS_MAX_ROOTS+1];
+
+    /*
+     * Product table of the generator polynomial used by the encoder:
+     * gg_mul[f][j] = f * g_j in polynomial form, for every feedback symbol f.
+     * Row 0 is all zeros, so the encoder needs no special case for zero feedback.
+     * This and the tables below start on a cache line, so that a row never
+     * straddles two lines (codecs are allocated with aligned_alloc()).
+     */
+    _Alignas(64) unsigned char gg_mul[RS_MAX_NN+1][RS_MAX_ROOTS];
+
+    /*
+     * Multiplication tables for the vectorised kernels in gf_simd.h, one set per
+     * field element c (polynomial form):
+     *  - nib[c][0][x] = c*x and nib[c][1][x] = c*(x<<4) for x=0..15, so that
+     *    c*x = nib[c][0][x & 0xF] ^ nib[c][1][x >> 4]  (split-nibble/PSHUFB)
+     *  - aff[c] is the 8x8 bit matrix of multiplication by c as used by the
+     *    GFNI affine instruction (gf2p8affineqb). Unlike gf2p8mulb this works for
+     *    any primitive polynomial, not just the AES one.
+     */
+    _Alignas(64) unsigned char nib[RS_MAX_NN+1][2][16];
+    unsigned long long aff[RS_MAX_NN+1];
+
+    /*
+     * Syndrome columns: col[j*np+i] = alpha**(prim*(fcr+i)*j) is the weight of
+     * received symbol j in syndrome s_(i+1), i=0..np-1. Rows are np symbols
+     * apart, so that consecutive rows can be loaded as one vector. col_lo/hi
+     * hold the low and high nibbles, ready to be used as PSHUFB indices into nib[].
+     */
+    _Alignas(64) unsigned char col[RS_MAX_NN*RS_MAX_ROOTS], col_lo[RS_MAX_NN*RS_MAX_ROOTS], col_hi[RS_MAX_NN*RS_MAX_ROOTS];
+
+};
+
+typedef struct rs_codec rs_codec_t;
+
 /*
- * The following variables will not be used simultaneously and can therefore be
- * defined globally in order to save execution time by not having to allocate
- * and deallocate frequently (mainly applies to recd).
+ * STATIC CODECS
  *
- * This is a (albeit highly simplified) method of static memory allocation.
+ * With RS_STATIC_TABLES defined, the tables of the codes selected in the build
+ * (RS_STATIC_CODES in CMakeLists.txt) are generated at compile time by
+ * rs_gen.c and included here as static const codecs rs_static_<code>. These
+ * need no initialisation: rs_default_codec() and rs_codec_get() return them
+ * directly, and encode_rs()/decode_rs() are specialised on the default code.
  */
-short pp[mm+1] = { 1, 0, 1, 1, 1, 0, 0, 0, 1 }; /* primitive polynomial p(x) = 1+x^2+x^3+x^4+x^8 */
-short alpha_to[nn+1], index_of[nn+1], gg[nn-kk+1], recd[nn];
 
-/* generate GF(2**mm) from the irreducible polynomial p(X) in pp[0]..pp[mm]
-   lookup tables:  index->polynomial form   alpha_to[] contains j=alpha**i;
+#ifdef RS_STATIC_TABLES
+#include "rs_tables.h"
+#endif
+
+/* Check the parameters par and derive q, np, t and iprim from them.
+   Returns 0 on success, -1 if the parameters do not describe a code.  */
+static inline int rs_set_params(rs_codec_t * rs, const rs_params_t * par)
+{
+    int q, a, b, r ;
+
+    if (par->m < 2 || par->m > RS_MAX_MM)                       return -1 ;
+    if ((par->poly >> par->m) != 1)                             return -1 ;
+    q = (1 << par->m) - 1 ;
+    if (par->n > q || par->k < 1 || par->k >= par->n)           return -1 ;
+    if (par->n - par->k > RS_MAX_ROOTS)                         return -1 ;
+    if (par->fcr < 0 || par->prim < 1 || par->prim >= q)        return -1 ;
+
+    /* prim must be coprime to q for the roots to be distinct */
+    for (a=q, b=par->prim; b!=0; a=b, b=r)
+        r = a % b ;
+    if (a != 1)                                                 return -1 ;
+
+    rs->par = *par ;
+    rs->q   = q ;
+    rs->np  = par->n - par->k ;
+    rs->t   = rs->np / 2 ;
+
+    for (rs->iprim=1; (rs->iprim*par->prim) % q != 1; rs->iprim++) ;
+
+    return 0 ;
+}
+
+/* Fill rs->nib[][][] and rs->aff[] from alpha_to[] and index_of[]; called by
+   rs_generate_gf(). Products are formed in index form: c*x = alpha**(i_c+i_x).
+*/
+static inline void rs_gen_nib_tables(rs_codec_t * rs)
+{
+    register int c,x,i,k ;
+    int p ;
+    const int q = rs->q ;
+    const unsigned char * alpha_to = rs->alpha_to ;
+    const short * index_of = rs->index_of ;
+
+    for (c=0; c<=q; c++)
+    {
+        for (x=0; x<16; x++)
+        {   rs->nib[c][0][x] = (c && x && x <= q)           ? (unsigned char) alpha_to[(index_of[c]+index_of[x])%q]    : 0 ;
+            rs->nib[c][1][x] = (c && x && (x<<4) <= q)      ? (unsigned char) alpha_to[(index_of[c]+index_of[x<<4])%q] : 0 ;
+        }
+
+        /* column k of the matrix is c*alpha**k, row i of the matrix is stored
+           in byte 7-i of aff[c] */
+        rs->aff[c] = 0 ;
+        for (k=0; k<rs->par.m; k++)
+        {   p = c ? alpha_to[(index_of[c]+k)%q] : 0 ;
+            for (i=0; i<rs->par.m; i++)
+                if (p & (1<<i))
+                    rs->aff[c] |= 1ULL << (8*(7-i)+k) ;
+        }
+    }
+}
+
+/* generate GF(2**m) from the irreducible polynomial p(X) in rs->par.poly
+   lookup tables:  index->polynomial form   alpha_to[] contains j=alpha**i,
+                                            i=0..2q-1;
                    polynomial form -> index form  index_of[j=alpha**i] = i
-   alpha=2 is the primitive element of GF(2**mm)
+   alpha=2 is the primitive element of GF(2**m)
+   Returns -1 if p(X) is not primitive, i.e. alpha**i = 0 or 1 for some 0<i<q.
 */
-void generate_gf()
+static inline int rs_generate_gf(rs_codec_t * rs)
 {
     register int i, mask ;
+    const int m = rs->par.m, q = rs->q ;
+    unsigned char * alpha_to = rs->alpha_to ;
+    short * index_of = rs->index_of ;
 
     mask = 1 ;
-    alpha_to[mm] = 0 ;
-    for (i=0; i<mm; i++)
+    alpha_to[m] = 0 ;
+    for (i=0; i<m; i++)
     { alpha_to[i] = mask ;
         index_of[alpha_to[i]] = i ;
-        if (pp[i]!=0)
-            alpha_to[mm] ^= mask ;
+        if (rs->par.poly & (1<<i))
+            alpha_to[m] ^= mask ;
         mask <<= 1 ;
     }
-    index_of[alpha_to[mm]] = mm ;
+    if (alpha_to[m] <= 1)
+        return -1 ;
+    index_of[alpha_to[m]] = m ;
     mask >>= 1 ;
-    for (i=mm+1; i<nn; i++)
+    for (i=m+1; i<q; i++)
     {
         if (alpha_to[i-1] >= mask)
-            alpha_to[i] = alpha_to[mm] ^ ((alpha_to[i-1]^mask)<<1) ;
+            alpha_to[i] = alpha_to[m] ^ ((alpha_to[i-1]^mask)<<1) ;
         else alpha_to[i] = alpha_to[i-1]<<1 ;
+        if (alpha_to[i] <= 1)
+            return -1 ;
         index_of[alpha_to[i]] = i ;
     }
+    for (i=q; i<2*q; i++)   /* doubled, so that alpha_to[a+b] needs no reduction for a,b < q */
+        alpha_to[i] = alpha_to[i-q] ;
     index_of[0] = -1 ;
 
+    rs_gen_nib_tables(rs) ;
+    return 0 ;
+}
 
+/* Fill gg_mul[][] from gg[] (index form): row f holds the product of the
+   feedback symbol f with every tap g_0..g_(np-1) of the generator polynomial
+*/
+static inline void rs_gen_mul_table(rs_codec_t * rs)
+{
+    register int f,j ;
+    const int q = rs->q ;
+    const unsigned char * alpha_to = rs->alpha_to ;
+    const short * index_of = rs->index_of, * gg = rs->gg ;
+
+    for (j=0; j<rs->np; j++)  rs->gg_mul[0][j] = 0 ;
+    for (f=1; f<=q; f++)
+        for (j=0; j<rs->np; j++)
+            if (gg[j] != -1)
+                rs->gg_mul[f][j] = (unsigned char) alpha_to[(gg[j]+index_of[f])%q] ;
+            else
+                rs->gg_mul[f][j] = 0 ;
+}
+
+/* Fill col[] and its nibbles col_lo/hi[] */
+static inline void rs_gen_col_table(rs_codec_t * rs)
+{
+    register int i,j ;
+    int root ;
+    const int q = rs->q, np = rs->np ;
+
+    for (i=0; i<np; i++)
+    {   root = (rs->par.prim * ((rs->par.fcr+i) % q)) % q ;
+        for (j=0; j<rs->par.n; j++)
+        {   rs->col[j*np+i]    = (unsigned char) rs->alpha_to[(root*j)%q] ;
+            rs->col_lo[j*np+i] = rs->col[j*np+i] & 0xF ;
+            rs->col_hi[j*np+i] = rs->col[j*np+i] >> 4 ;
+        }
+    }
 }
 
-/* Obtain the generator polynomial of the tt-error correcting, length
-  nn=(2**mm -1) Reed Solomon code  from the product of (X+alpha**i), i=1..2*tt
+/* Obtain the generator polynomial of the t-error correcting Reed Solomon code
+   from the product of (X+alpha**(prim*(fcr+i))), i=0..np-1
 */
-void gen_poly()
+static inline void rs_gen_poly(rs_codec_t * rs)
 {
     register int i,j ;
+    int root ;
+    const int q = rs->q ;
+    const unsigned char * alpha_to = rs->alpha_to ;
+    const short * index_of = rs->index_of ;
+    short * gg = rs->gg ;
 
-    gg[0] = 2 ;    /* primitive element alpha = 2  for GF(2**mm)  */
-    gg[1] = 1 ;    /* g(x) = (X+alpha) initially */
-    for (i=2; i<=nn-kk; i++)
-    { gg[i] = 1 ;
+    root = (rs->par.prim * (rs->par.fcr % q)) % q ;
+    gg[0] = alpha_to[root] ;
+    gg[1] = 1 ;    /* g(x) = (X+alpha**(prim*fcr)) initially */
+    for (i=2; i<=rs->np; i++)
+    { root = (root + rs->par.prim) % q ;
+        gg[i] = 1 ;
         for (j=i-1; j>0; j--)
-            if (gg[j] != 0)  gg[j] = gg[j-1]^ alpha_to[(index_of[gg[j]]+i)%nn] ;
+            if (gg[j] != 0)  gg[j] = gg[j-1]^ alpha_to[(index_of[gg[j]]+root)%q] ;
             else gg[j] = gg[j-1] ;
-        gg[0] = alpha_to[(index_of[gg[0]]+i)%nn] ;     /* gg[0] can never be zero */
+        gg[0] = alpha_to[(index_of[gg[0]]+root)%q] ;     /* gg[0] can never be zero */
     }
     /* convert gg[] to index form for quicker encoding */
-    for (i=0; i<=nn-kk; i++)  gg[i] = index_of[gg[i]] ;
+    for (i=0; i<=rs->np; i++)  gg[i] = index_of[gg[i]] ;
+
+    rs_gen_mul_table(rs) ;
+    rs_gen_col_table(rs) ;
+}
+
+/* Build all tables of a codec for the code par. The codec is read-only
+   afterwards. Returns 0 on success, -1 if par is not a valid code.     */
+static inline int rs_init(rs_codec_t * rs, const rs_params_t * par)
+{
+    memset(rs, 0, sizeof(rs_codec_t)) ;
+
+    if (rs_set_params(rs, par) != 0 || rs_generate_gf(rs) != 0)
+        return -1 ;
+    rs_gen_poly(rs) ;
+
+    return 0 ;
+}
+
+/*
+ * DEFAULT CODEC
+ *
+ * Used by encode_rs(), decode_rs() and the transfer functions. Its tables are
+ * built by generate_gf() and gen_poly(), which should be called once during
+ * system boot (before any threads are started), or otherwise on first use by
+ * rs_default_codec(), once: a thread that comes in while another one builds
+ * them waits until they are ready, so any thread may encode or decode first.
+ * With static tables (RS_STATIC_DEFAULT) the default codec is rs_static_default
+ * and no initialisation is needed.
+ */
+
+#define RS_DEFAULT_BUILDING 1
+#define RS_DEFAULT_READY    2
+
+static rs_codec_t rs_default ;
+static _Atomic int rs_default_state = 0 ;   /* 0, RS_DEFAULT_BUILDING or RS_DEFAULT_READY */
+
+static inline void generate_gf()
+{
+    rs_set_params(&rs_default, &rs_default_params) ;
+    rs_generate_gf(&rs_default) ;
+}
+
+static inline void gen_poly()
+{
+    rs_gen_poly(&rs_default) ;
+    atomic_store_explicit(&rs_default_state, RS_DEFAULT_READY, memory_order_release) ;
+}
+
+static inline const rs_codec_t * rs_default_codec()
+{
+#ifdef RS_STATIC_DEFAULT
+    return &rs_static_default ;
+#else
+    int state = atomic_load_explicit(&rs_default_state, memory_order_acquire) ;
+
+    if (state != RS_DEFAULT_READY)
+    {   /* the first thread builds the tables and publishes them, the others wait */
+        if (state == 0 && atomic_compare_exchange_strong_explicit(&rs_default_state, &state, RS_DEFAULT_BUILDING,
+                                                                  memory_order_acquire, memory_order_acquire))
+        {   rs_init(&rs_default, &rs_default_params) ;
+            atomic_store_explicit(&rs_default_state, RS_DEFAULT_READY, memory_order_release) ;
+        }
+        else
+            while (atomic_load_explicit(&rs_default_state, memory_order_acquire) != RS_DEFAULT_READY) ;
+    }
+
+    return &rs_default ;
+#endif
+}
+
+/*
+ * CODEC CACHE
+ *
+ * Codecs for other codes, e.g. one per virtual channel, are looked up by
+ * their parameters with rs_codec_get(). The tables of a code are built on
+ * first use only and then shared by all later users, from any thread.
+ * Cached codecs live until rs_codec_cache_free(). Static codecs are returned
+ * without being cached. With RS_NO_HEAP defined (see transfer.h) nothing is
+ * allocated and rs_codec_get() only returns static codecs; other codecs can
+ * be set up in caller storage with rs_init().
+ */
+
+#ifndef RS_MAX_CODECS
+#define RS_MAX_CODECS 16
+#endif
+
+#ifndef RS_NO_HEAP
+static rs_codec_t * rs_cache[RS_MAX_CODECS] ;
+static int rs_cached = 0 ;
+static atomic_flag rs_cache_lock = ATOMIC_FLAG_INIT ;
+#endif
+
+static inline int rs_params_equal(const rs_params_t * a, const rs_params_t * b)
+{
+    return a->m == b->m && a->poly == b->poly && a->n == b->n && a->k == b->k &&
+           a->fcr == b->fcr && a->prim == b->prim ;
+}
+
+/* Returns the codec of the code par, building it if this is the first request
+   for it, or NULL if par is not a valid code or the cache is full.       */
+static inline const rs_codec_t * rs_codec_get(const rs_params_t * par)
+{
+    register int i = 0 ;
+    rs_codec_t * rs = NULL ;
+#ifdef RS_STATIC_CODECS
+    static const rs_codec_t * const statics[] = { RS_STATIC_CODECS } ;
+
+    for (i=0; i<(int) (sizeof(statics)/sizeof(statics[0])); i++)
+        if (rs_params_equal(&(statics[i]->par), par))
+            return statics[i] ;
+#endif
+#ifdef RS_NO_HEAP
+    (void) i ; (void) rs ; (void) par ;
+    return NULL ;
+#else
+
+    while (atomic_flag_test_and_set_explicit(&rs_cache_lock, memory_order_acquire)) ;
+
+    for (i=0; i<rs_cached; i++)
+        if (rs_params_equal(&(rs_cache[i]->par), par))
+        {   rs = rs_cache[i] ;
+            break ;
+        }
+
+    if (rs == NULL && rs_cached < RS_MAX_CODECS && (rs = aligned_alloc(64, sizeof(rs_codec_t))) != NULL)
+    {   if (rs_init(rs, par) == 0)
+            rs_cache[rs_cached++] = rs ;
+        else
+        {   free(rs) ;
+            rs = NULL ;
+        }
+    }
+
+    atomic_flag_clear_explicit(&rs_cache_lock, memory_order_release) ;
+
+    return rs ;
+#endif
+}
+
+// Free all cached codecs; none of them may be in use.
+static inline void rs_codec_cache_free()
+{
+#ifndef RS_NO_HEAP
+    while (atomic_flag_test_and_set_explicit(&rs_cache_lock, memory_order_acquire)) ;
+
+    while (rs_cached > 0)
+        free(rs_cache[--rs_cached]) ;
+
+    atomic_flag_clear_explicit(&rs_cache_lock, memory_order_release) ;
+#endif
 }
 
 #endif //RS_H
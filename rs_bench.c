@@ -0,0 +1,354 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * ----------RS BENCHMARK----------
+ *
+ * Measures the throughput and the per-call latency of the encoder, the
+ * decoder and the transfer functions of the default code, for:
+ *  - encode_rs(), and encode_packets() on batches of 1..256 packets
+ *  - decode_rs() with 0..tt+2 errors per packet (more than tt: uncorrectable)
+ *  - decode_rs_erasures() with 0..2*tt erasures per packet
+ *  - gen_transfer() and unpack_transfer() for messages of 1..4096 packets
+ *  - decode_transfer_mt() with tt/2 errors per packet on 1..2*cores threads
+ *  - the decode pipeline (pipeline.h) with tt/2 errors per packet on 1..2*cores
+ *    threads, fed in bursts of PIPELINE_BURST packets with idle gaps between
+ *    them; the latency is per packet, from pipeline_submit() to pipeline_poll()
+ *
+ * Output is CSV on stdout, one line per measurement:
+ *      bench,param,calls,mb_s,p50_ns,p90_ns,p99_ns,max_ns
+ * param is the # of errors, erasures, packets or threads; mb_s counts data
+ * (not parity) bytes; the percentiles are of the time per call (per packet for
+ * the pipeline, whose mb_s is over the bursts, without the gaps).
+ *
+ * Usage: rs_bench [-n calls] [-k kernel]
+ *   kernel: scalar, ssse3, avx2, avx512 or gfni (see gf_simd.h); default is
+ *   the fastest one supported.
+ */
+
+#define MSG_TYPE uint8_t
+#define TYPE_MAX UINT8_MAX
+
+#include "rs.h"
+#include "encoder.h"
+#include "decoder.h"
+#include "parallel.h"
+#include "pipeline.h"
+
+#define SAMPLES 64      // # of different packets per measurement
+
+#define PIPELINE_BURST  256     // # of packets per burst of bench_pipeline()
+#define PIPELINE_GAP    200000  // Idle time between bursts, ns
+
+static long long * lat;     // Time per call of the current measurement, ns
+static int calls = 20000;
+
+static long long now_ns()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static int cmp_ll(const void * a, const void * b)
+{
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return (x > y) - (x < y);
+}
+
+// Print a measurement of n calls, each on bytes data bytes, that took total ns, with latencies lat[0..n-1]
+static void report_total(const char * bench, int param, int n, long long bytes, long long total)
+{
+    qsort(lat, n, sizeof(long long), cmp_ll);
+
+    printf("%s,%d,%d,%.1f,%lld,%lld,%lld,%lld\n", bench, param, n, (total > 0) ? bytes * n * 1e3 / total : 0.0,
+           lat[n/2], lat[(int) (n*0.9)], lat[(int) (n*0.99)], lat[n-1]);
+    fflush(stdout);
+}
+
+// Print a measurement of n consecutive calls, see report_total()
+static void report(const char * bench, int param, int n, long long bytes)
+{
+    long long total = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        total += lat[i];
+    report_total(bench, param, n, bytes, total);
+}
+
+// Flip count distinct random symbols of a packet (codeword positions, see recd_rs())
+static void corrupt(packet_t * packet, int * pos, int count)
+{
+    int i, j;
+
+    for (i = 0; i < count; i++)
+    {
+        do {
+            pos[i] = rand() % nn;
+            for (j = 0; j < i && pos[j] != pos[i]; j++) ;
+        } while (j < i);
+
+        *recd_rs(packet, pos[i]) ^= (MSG_TYPE) (1 + rand() % TYPE_MAX);
+    }
+}
+
+static void random_packet(packet_t * packet, int seq)
+{
+    MSG_TYPE data[kk];
+    int i;
+
+    for (i = 0; i < kk; i++)
+        data[i] = (MSG_TYPE) rand();
+    fill_packet(packet, data, kk, seq);
+}
+
+static void bench_encode(void)
+{
+    static packet_t packs[SAMPLES];
+    long long t;
+    int i;
+
+    for (i = 0; i < SAMPLES; i++)
+        random_packet(&packs[i], i);
+
+    for (i = 0; i < calls; i++)
+    {
+        t = now_ns();
+        encode_rs(&packs[i % SAMPLES]);
+        lat[i] = now_ns() - t;
+    }
+    report("encode_rs", 0, calls, kk);
+}
+
+// encode_packets() of batches of packets packets
+static void bench_encode_batch(int packets)
+{
+    packet_t * packs = malloc(packets * sizeof(packet_t));
+    int n = calls / packets, i;
+    long long t;
+
+    if (n < 10) n = 10;
+    for (i = 0; i < packets; i++)
+        random_packet(&packs[i], i);
+
+    for (i = 0; i < n; i++)
+    {
+        t = now_ns();
+        encode_packets(packs, packets);
+        lat[i] = now_ns() - t;
+    }
+    report("encode_packets", packets, n, (long long) packets * kk);
+
+    free(packs);
+}
+
+// decode_rs() with errors errors per packet, or decode_rs_erasures() with that many erasures
+static void bench_decode(int errors, int erasures)
+{
+    static packet_t sent[SAMPLES];
+    static int pos[SAMPLES][nn];
+    packet_t packet;
+    long long t;
+    int i;
+
+    for (i = 0; i < SAMPLES; i++)
+    {
+        random_packet(&sent[i], i);
+        corrupt(&sent[i], pos[i], erasures ? erasures : errors);
+    }
+
+    for (i = 0; i < calls; i++)
+    {
+        packet = sent[i % SAMPLES];
+        t = now_ns();
+        if (erasures)
+            decode_rs_erasures(&packet, pos[i % SAMPLES], erasures, NULL);
+        else
+            decode_rs(&packet, NULL);
+        lat[i] = now_ns() - t;
+    }
+    report(erasures ? "decode_rs_erasures" : "decode_rs", erasures ? erasures : errors, calls, kk);
+}
+
+// gen_transfer() and unpack_transfer() of a message of packets full packets
+static void bench_transfer(int packets)
+{
+    int size = packets * kk, n = calls / packets, i;
+    MSG_TYPE * msg = malloc(size), * out;
+    transfer_t transfer;
+    long long t;
+
+    if (n < 10) n = 10;
+    for (i = 0; i < size; i++)
+        msg[i] = (MSG_TYPE) rand();
+
+    for (i = 0; i < n; i++)
+    {
+        t = now_ns();
+        transfer = gen_transfer(msg, size);
+        lat[i] = now_ns() - t;
+        free(transfer.packs);
+    }
+    report("gen_transfer", packets, n, size);
+
+    transfer = gen_transfer(msg, size);
+    for (i = 0; i < n; i++)
+    {
+        t = now_ns();
+        out = unpack_transfer(&transfer, NULL);
+        lat[i] = now_ns() - t;
+        free(out);
+    }
+    report("unpack_transfer", packets, n, size);
+
+    free(transfer.packs);
+    free(msg);
+}
+
+// decode_transfer_mt() of a transfer with tt/2 errors per packet
+static void bench_threads(int threads, int packets)
+{
+    int size = packets * kk, n = calls / packets, i, pos[nn];
+    MSG_TYPE * msg = malloc(size);
+    transfer_t sent, transfer;
+    thread_pool_t pool;
+    long long t;
+
+    if (n < 10) n = 10;
+    for (i = 0; i < size; i++)
+        msg[i] = (MSG_TYPE) rand();
+
+    sent     = gen_transfer(msg, size);
+    transfer = gen_transfer(msg, size);
+    for (i = 0; i < packets; i++)
+        corrupt(&sent.packs[i], pos, tt/2);
+
+    thread_pool_init(&pool, threads);
+    for (i = 0; i < n; i++)
+    {
+        memcpy(transfer.packs, sent.packs, packets * sizeof(packet_t));
+        t = now_ns();
+        decode_transfer_mt(&pool, &transfer, NULL);
+        lat[i] = now_ns() - t;
+    }
+    thread_pool_free(&pool);
+    report("decode_transfer_mt", threads, n, size);
+
+    free(sent.packs);
+    free(transfer.packs);
+    free(msg);
+}
+
+// Packets with tt/2 errors through a decode pipeline of threads threads, in bursts
+static void bench_pipeline(int threads)
+{
+    static packet_t sent[SAMPLES];
+    long long * submitted = malloc(calls * sizeof(long long)), start, total = 0;
+    struct timespec gap = { 0, PIPELINE_GAP };
+    pipeline_t pipeline;
+    pipeline_result_t result;
+    int pos[nn], sub = 0, got = 0, i;
+
+    for (i = 0; i < SAMPLES; i++)
+    {
+        random_packet(&sent[i], i);
+        corrupt(&sent[i], pos, tt/2);
+    }
+
+    if (submitted == NULL || pipeline_init(&pipeline, threads, 64) != 0)
+    {
+        free(submitted);
+        return;
+    }
+
+    while (got < calls)
+    {
+        // Submit a burst as fast as the pipeline takes it, waiting for a result whenever it is full
+        start = now_ns();
+        for (i = 0; i < PIPELINE_BURST && sub < calls; )
+        {
+            if (pipeline_submit(&pipeline, &sent[sub % SAMPLES]) == 0)
+            {
+                submitted[sub++] = now_ns();
+                i++;
+            }
+            else if (pipeline_poll_wait(&pipeline, &result))
+            {
+                lat[got] = now_ns() - submitted[got];
+                got++;
+            }
+        }
+        while (pipeline_poll_wait(&pipeline, &result))
+        {
+            lat[got] = now_ns() - submitted[got];
+            got++;
+        }
+        total += now_ns() - start;
+
+        nanosleep(&gap, NULL);
+    }
+
+    pipeline_free(&pipeline);
+    free(submitted);
+    report_total("pipeline", threads, calls, kk, total);
+}
+
+int main(int argc, char * argv[])
+{
+    int i, cores = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    const char * kernel = NULL;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i+1 < argc)       calls  = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-k") == 0 && i+1 < argc)  kernel = argv[++i];
+        else
+        {
+            fprintf(stderr, "Usage: %s [-n calls] [-k kernel]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (calls < 100) calls = 100;
+    if (gf_select(kernel) == NULL)
+    {
+        fprintf(stderr, "%s: kernel %s not supported\n", argv[0], kernel);
+        return 1;
+    }
+    if ((lat = malloc(calls * sizeof(long long))) == NULL)
+        return 1;
+
+    srand(1);
+    fprintf(stderr, "RS(%d,%d), kernel %s, %d calls\n", nn, kk, gf_active()->name, calls);
+    printf("bench,param,calls,mb_s,p50_ns,p90_ns,p99_ns,max_ns\n");
+
+    bench_encode();
+
+    for (i = 1; i <= 256; i *= 4)
+        bench_encode_batch(i);
+
+    for (i = 0; i <= tt+2; i++)
+        bench_decode(i, 0);
+
+    for (i = 2; i <= 2*tt; i += 2)
+        bench_decode(0, i);
+
+    for (i = 1; i <= 4096; i *= 16)
+        bench_transfer(i);
+
+    for (i = 1; i <= 2*cores; i *= 2)
+        bench_threads(i, 1024);
+
+    for (i = 1; i <= 2*cores; i *= 2)
+        bench_pipeline(i);
+
+    free(lat);
+
+    return 0;
+}
@@ -0,0 +1,236 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * ----------RS FILE CODER----------
+ *
+ * Encodes a file into Reed Solomon protected packets, or decodes such a file
+ * back, e.g. for archiving telemetry. Input and output are memory mapped and
+ * the packets are processed on all cores (parallel.h), so files of any size
+ * are handled at disk speed without being read into transfer_t arrays.
+ *
+ * Encoded file format: the packets of the file in wire format (see
+ * serialize_packet()), back to back. Every packet carries kk bytes of the file,
+ * except the last one, which carries the remaining 1..kk bytes as a shortened
+ * code. Packet i therefore starts at byte i*(HEADER_SIZE+nn), so the decoder
+ * finds the packets by their position: the header, which is not protected by
+ * the code, is not needed to find them. The sequence number in the header is
+ * the packet number modulo SEQ_LIMIT (see transfer.h).
+ *
+ * Usage: rs_file encode|decode [-j threads] <input> <output>
+ *
+ * Prints the decoding statistics of the file, and in a profiling build
+ * (RS_PROFILE, see profile.h) the codec profile as JSON on stderr. The exit
+ * status is 0 on success, 1 on errors and 2 if any packet of a decoded file
+ * was uncorrectable (it is then written as received).
+ */
+
+#define MSG_TYPE uint8_t
+#define TYPE_MAX UINT8_MAX
+
+#include "rs.h"
+#include "encoder.h"
+#include "decoder.h"
+#include "parallel.h"
+
+#define PACKET_WIRE (HEADER_SIZE + nn)  // Wire size of a full packet
+#define BLOCK       GF_BATCH            // # of packets per task, encoded as one batch
+
+struct file_job {
+
+    const MSG_TYPE * in;
+    MSG_TYPE * out;
+    long long size;         // Size of the decoded file
+    long long packets;      // # of packets in the encoded file
+
+};
+
+// Data length of packet p
+static int packet_length(const struct file_job * job, long long p)
+{
+    return (job->size - p*kk < kk) ? (int) (job->size - p*kk) : kk;
+}
+
+// Encode a block of packets as one batch, straight from the input into the output
+static void encode_block(void * arg, int b, transfer_stats_t * stats)
+{
+    const struct file_job * job = (const struct file_job *) arg;
+    long long p, first = (long long) b*BLOCK;
+    const MSG_TYPE * data[BLOCK];
+    MSG_TYPE * bb[BLOCK], * out;
+    int len[BLOCK], n = 0;
+
+    (void) stats;
+
+    for (p = first; p < first + BLOCK && p < job->packets; p++, n++)
+    {
+        len[n]  = packet_length(job, p);
+        data[n] = &(job->in[p*kk]);
+        out     = &(job->out[p*PACKET_WIRE]);
+        bb[n]   = &out[HEADER_SIZE + len[n]];
+
+        write_header(out, len[n], (int) (p & SEQ_MASK));
+        memcpy(&out[HEADER_SIZE], data[n], len[n]);
+    }
+
+    rs_encode_batch(rs_default_codec(), data, len, bb, n);
+}
+
+static void decode_block(void * arg, int b, transfer_stats_t * stats)
+{
+    const struct file_job * job = (const struct file_job *) arg;
+    long long p, end = (b+1LL)*BLOCK;
+    MSG_TYPE buf[PACKET_WIRE];
+    decode_status_t st;
+    int F_length, size;
+
+    for (p = (long long) b*BLOCK; p < end && p < job->packets; p++)
+    {
+        // Decode a private copy of the packet, its length follows from its position
+        F_length = packet_length(job, p);
+        size     = HEADER_SIZE + F_length + (nn-kk);
+
+        memcpy(buf, &(job->in[p*PACKET_WIRE]), size);
+        buf[3] = (MSG_TYPE) F_length;
+
+        decode_wire(buf, size, &st);
+        count_status(stats, &st);
+
+        memcpy(&(job->out[p*kk]), &buf[HEADER_SIZE], F_length);
+    }
+}
+
+// Map size bytes of file fd, NULL on failure. An empty file is mapped to a dummy address.
+static MSG_TYPE * map_file(int fd, long long size, int writable)
+{
+    static MSG_TYPE empty[1];
+    void * map;
+
+    if (size == 0) return empty;
+
+    map = mmap(NULL, (size_t) size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+               writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+
+    return (map == MAP_FAILED) ? NULL : (MSG_TYPE *) map;
+}
+
+static double now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(int argc, char * argv[])
+{
+    int encode, threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int in_fd, out_fd, arg = 2;
+    long long in_size, out_size, rem;
+    struct stat sb;
+    struct file_job job;
+    transfer_stats_t stats;
+    thread_pool_t pool;
+    double t;
+
+    if (argc > 3 && strcmp(argv[2], "-j") == 0)
+    {
+        threads = atoi(argv[3]);
+        arg     = 4;
+    }
+
+    if (argc != arg + 2 || (strcmp(argv[1], "encode") != 0 && strcmp(argv[1], "decode") != 0))
+    {
+        fprintf(stderr, "Usage: %s encode|decode [-j threads] <input> <output>\n", argv[0]);
+        return 1;
+    }
+    encode = (strcmp(argv[1], "encode") == 0);
+
+    if ((in_fd = open(argv[arg], O_RDONLY)) < 0 || fstat(in_fd, &sb) != 0)
+    {
+        perror(argv[arg]);
+        return 1;
+    }
+    in_size = sb.st_size;
+
+    // Sizes of both files and # of packets
+    if (encode)
+    {
+        job.size    = in_size;
+        job.packets = in_size/kk + (in_size % kk != 0);
+        out_size    = (in_size == 0) ? 0 : (job.packets-1)*PACKET_WIRE + HEADER_SIZE + packet_length(&job, job.packets-1) + (nn-kk);
+    }
+    else
+    {
+        rem = in_size % PACKET_WIRE;
+        if (rem != 0 && rem <= HEADER_SIZE + (nn-kk))
+        {
+            fprintf(stderr, "%s: not an encoded file (size %lld)\n", argv[arg], in_size);
+            return 1;
+        }
+        job.packets = in_size/PACKET_WIRE + (rem != 0);
+        job.size    = (in_size/PACKET_WIRE)*kk + ((rem != 0) ? rem - HEADER_SIZE - (nn-kk) : 0);
+        out_size    = job.size;
+    }
+
+    if ((out_fd = open(argv[arg+1], O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0 || ftruncate(out_fd, out_size) != 0)
+    {
+        perror(argv[arg+1]);
+        return 1;
+    }
+
+    job.in  = map_file(in_fd, in_size, 0);
+    job.out = map_file(out_fd, out_size, 1);
+    if (job.in == NULL || job.out == NULL)
+    {
+        perror("mmap");
+        return 1;
+    }
+
+    if (thread_pool_init(&pool, threads) != 0)
+    {
+        fprintf(stderr, "%s: cannot start %d threads\n", argv[0], threads);
+        return 1;
+    }
+
+    t     = now();
+    stats = thread_pool_run(&pool, (int) ((job.packets + BLOCK-1) / BLOCK), encode ? encode_block : decode_block, &job);
+    t     = now() - t;
+
+    thread_pool_free(&pool);
+
+    if (in_size > 0)  munmap((void *) job.in, (size_t) in_size);
+    if (out_size > 0) munmap(job.out, (size_t) out_size);
+    close(in_fd);
+    if (close(out_fd) != 0)
+    {
+        perror(argv[arg+1]);
+        return 1;
+    }
+
+    if (encode)
+        printf("%s: %lld bytes, %lld packets, %.1f MB/s\n", argv[arg], in_size, job.packets,
+               (t > 0) ? in_size / t / 1e6 : 0.0);
+    else
+        printf("%s: %lld bytes, %d packets: %d clean, %d corrected (%d symbols, at most %d per packet), "
+               "%d uncorrectable, %.1f MB/s\n", argv[arg], out_size, stats.packets, stats.clean, stats.corrected,
+               stats.symbols, stats.max_count, stats.uncorrectable, (t > 0) ? in_size / t / 1e6 : 0.0);
+
+#ifdef RS_PROFILE
+    rs_profile_t prof;
+    char json[4096];
+
+    rs_profile_snapshot(&prof);
+    rs_profile_json(&prof, json, sizeof(json));
+    fprintf(stderr, "%s\n", json);
+#endif
+
+    return (stats.uncorrectable > 0) ? 2 : 0;
+}
@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+/*
+ * ----------RS TABLE GENERATOR----------
+ *
+ * Writes the tables of one or more codes to a header as static const
+ * rs_codec_t initialisers, so that they are part of the binary rather than
+ * built at startup. The tables are built by rs_init(), exactly as at runtime.
+ * Run by the build (see CMakeLists.txt); the output is included by rs.h when
+ * RS_STATIC_TABLES is defined.
+ *
+ * Usage: rs_gen <output header> <code>...
+ *   code: default, ccsds223, ccsds239 or dvb (see rs.h)
+ */
+
+#include "rs.h"
+
+struct rs_preset {
+
+    const char * name;
+    rs_params_t par;
+
+};
+
+static const struct rs_preset presets[] = {
+        { "default",  RS_PARAMS_DEFAULT   },
+        { "ccsds223", RS_PARAMS_CCSDS_223 },
+        { "ccsds239", RS_PARAMS_CCSDS_239 },
+        { "dvb",      RS_PARAMS_DVB       },
+};
+
+#define PRESETS ((int) (sizeof(presets) / sizeof(presets[0])))
+
+// Print count values of a table, 16 per line
+static void print_bytes(FILE * f, const unsigned char * v, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+        fprintf(f, "%s%3u,", (i % 16 == 0) ? "\n        " : " ", v[i]);
+}
+
+static void print_shorts(FILE * f, const short * v, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+        fprintf(f, "%s%3d,", (i % 16 == 0) ? "\n        " : " ", v[i]);
+}
+
+static void print_codec(FILE * f, const char * name, const rs_codec_t * rs)
+{
+    int c;
+
+    fprintf(f, "\n#define RS_STATIC_");
+    for (c = 0; name[c] != '\0'; c++)
+        fputc(toupper((unsigned char) name[c]), f);
+    fprintf(f, "\n\n");
+    fprintf(f, "static const rs_codec_t rs_static_%s = {\n", name);
+    fprintf(f, "    .par = { %d, 0x%X, %d, %d, %d, %d },\n",
+            rs->par.m, rs->par.poly, rs->par.n, rs->par.k, rs->par.fcr, rs->par.prim);
+    fprintf(f, "    .q = %d, .np = %d, .t = %d, .iprim = %d,\n", rs->q, rs->np, rs->t, rs->iprim);
+
+    fprintf(f, "    .alpha_to = {");  print_bytes(f, rs->alpha_to, 2*rs->q);  fprintf(f, " },\n");
+    fprintf(f, "    .index_of = {");  print_shorts(f, rs->index_of, rs->q+1);  fprintf(f, " },\n");
+    fprintf(f, "    .gg = {");        print_shorts(f, rs->gg, rs->np+1);       fprintf(f, " },\n");
+
+    fprintf(f, "    .gg_mul = {\n");
+    for (c = 0; c <= rs->q; c++)
+    {
+        fprintf(f, "      {");  print_bytes(f, rs->gg_mul[c], rs->np);  fprintf(f, " },\n");
+    }
+    fprintf(f, "    },\n");
+
+    fprintf(f, "    .nib = {\n");
+    for (c = 0; c <= rs->q; c++)
+    {
+        fprintf(f, "      {{");  print_bytes(f, rs->nib[c][0], 16);
+        fprintf(f, " }, {");     print_bytes(f, rs->nib[c][1], 16);  fprintf(f, " }},\n");
+    }
+    fprintf(f, "    },\n");
+
+    fprintf(f, "    .aff = {");
+    for (c = 0; c <= rs->q; c++)
+        fprintf(f, "%s0x%016llXULL,", (c % 4 == 0) ? "\n        " : " ", rs->aff[c]);
+    fprintf(f, " },\n");
+
+    fprintf(f, "    .col = {");     print_bytes(f, rs->col,    rs->par.n * rs->np);  fprintf(f, " },\n");
+    fprintf(f, "    .col_lo = {");  print_bytes(f, rs->col_lo, rs->par.n * rs->np);  fprintf(f, " },\n");
+    fprintf(f, "    .col_hi = {");  print_bytes(f, rs->col_hi, rs->par.n * rs->np);  fprintf(f, " },\n");
+    fprintf(f, "};\n");
+}
+
+int main(int argc, char * argv[])
+{
+    int i, p;
+    FILE * f;
+    rs_codec_t * rs = malloc(sizeof(rs_codec_t));
+
+    if (argc < 3 || rs == NULL)
+    {
+        fprintf(stderr, "Usage: %s <output header> <code>...\n", argv[0]);
+        return 1;
+    }
+
+    if ((f = fopen(argv[1], "w")) == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    fprintf(f, "/* Generated by rs_gen, do not edit. */\n\n");
+    fprintf(f, "#if RS_MAX_ROOTS != %d\n#error \"rs_tables.h was generated for RS_MAX_ROOTS %d\"\n#endif\n",
+            RS_MAX_ROOTS, RS_MAX_ROOTS);
+
+    for (i = 2; i < argc; i++)
+    {
+        for (p = 0; p < PRESETS && strcmp(argv[i], presets[p].name) != 0; p++) ;
+
+        if (p == PRESETS || rs_init(rs, &(presets[p].par)) != 0)
+        {
+            fprintf(stderr, "%s: unknown code %s\n", argv[0], argv[i]);
+            fclose(f);
+            remove(argv[1]);
+            return 1;
+        }
+
+        print_codec(f, presets[p].name, rs);
+    }
+
+    fprintf(f, "\n#define RS_STATIC_CODECS ");
+    for (i = 2; i < argc; i++)
+        fprintf(f, "%s&rs_static_%s", (i > 2) ? ", " : "", argv[i]);
+    fprintf(f, "\n");
+
+    fclose(f);
+    free(rs);
+
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * ----------RS SELF TEST----------
+ *
+ * Runs rs_self_test() (see selftest.h): the encoders, decoders and every
+ * kernel set of this CPU against the original implementation, with random
+ * messages, codes and errors. Registered with CTest; the exit status is
+ * nonzero if any check fails.
+ *
+ * Usage: rs_selftest [-n iterations] [-s seed]
+ *   iterations per kernel set, default SELF_TEST_ITERATIONS; seed nonzero,
+ *   default 1. A failure is reproduced with the same seed.
+ */
+
+#define MSG_TYPE uint8_t
+#define TYPE_MAX UINT8_MAX
+
+#include "rs.h"
+#include "encoder.h"
+#include "decoder.h"
+#include "selftest.h"
+
+#define SELF_TEST_ITERATIONS 500  // Per kernel set
+
+int main(int argc, char * argv[])
+{
+    int iterations = SELF_TEST_ITERATIONS, opt;
+    unsigned int seed = 1;
+    self_test_t res;
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1)
+        switch (opt)
+        {
+            case 'n': iterations = atoi(optarg); break;
+            case 's': seed = (unsigned int) strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "usage: %s [-n iterations] [-s seed]\n", argv[0]);
+                return 2;
+        }
+
+    if (iterations < 1 || seed == 0)
+    {
+        fprintf(stderr, "%s: iterations must be positive and the seed nonzero\n", argv[0]);
+        return 2;
+    }
+
+    rs_self_test(iterations, seed, &res);
+
+    printf("Self test: %d checks, %d failed\n", res.checks, res.failures);
+    if (res.failures > 0)
+    {
+        printf("First failure: %s, kernel %s, iteration %d (seed %u)\n", res.check, res.kernel, res.iteration, seed);
+        return 1;
+    }
+
+    return 0;
+}
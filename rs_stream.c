@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * ----------RS STREAM CODER----------
+ *
+ * Sends standard input as a stream of Reed Solomon protected packets on
+ * standard output, or receives such a stream on standard input and writes the
+ * data it carries to standard output, e.g. at both ends of a pipe or socket:
+ *
+ *      rs_stream send < data | <link> | rs_stream recv > data
+ *
+ * See stream.h for the stream format. The receiver decodes every packet as it
+ * arrives, with constant memory, and resynchronises after lost or corrupted
+ * bytes. Only decoded packets are written: packets that cannot be decoded
+ * are left out of the output, as are lost ones, and counted.
+ *
+ * Usage: rs_stream send|recv
+ *
+ * The receiver prints the decoding statistics on stderr. The exit status is
+ * 0 on success, 1 on errors and 2 if any packet was uncorrectable or lost.
+ */
+
+#define MSG_TYPE uint8_t
+#define TYPE_MAX UINT8_MAX
+
+#include "rs.h"
+#include "encoder.h"
+#include "decoder.h"
+#include "stream.h"
+
+#define CHUNK 65536
+
+static void write_packet(const MSG_TYPE * buf, const decode_status_t * status, void * user)
+{
+    data_view_t view = wire_view(buf);
+
+    // As received, the data of an uncorrectable packet (or of a false marker) cannot be trusted
+    if (!status->success) return;
+
+    if (stream_write_all(STDOUT_FILENO, view.data, view.size) != 0)
+        *(int *) user = errno;
+}
+
+static int send_stream(void)
+{
+    static MSG_TYPE chunk[CHUNK];
+    stream_writer_t writer;
+    ssize_t n;
+
+    stream_writer_init(&writer, STDOUT_FILENO);
+
+    while ((n = read(STDIN_FILENO, chunk, CHUNK)) != 0)
+    {
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 || stream_write(&writer, chunk, (int) n) != 0)
+        {
+            perror("rs_stream");
+            return 1;
+        }
+    }
+
+    if (stream_writer_flush(&writer) != 0)
+    {
+        perror("rs_stream");
+        return 1;
+    }
+
+    return 0;
+}
+
+static int recv_stream(void)
+{
+    static stream_reader_t reader;
+    stream_stats_t * stats = &(reader.stats);
+    int error = 0, n;
+
+    stream_reader_init(&reader, STDIN_FILENO, write_packet, &error);
+
+    while ((n = stream_read(&reader)) > 0 && !error) ;
+
+    if (n < 0 || error)
+    {
+        if (error) errno = error;
+        perror("rs_stream");
+        return 1;
+    }
+
+    fprintf(stderr, "%d packets: %d clean, %d corrected (%d symbols, at most %d per packet), %d uncorrectable, "
+            "%d lost, %lld bytes skipped\n", stats->packets.packets, stats->packets.clean, stats->packets.corrected,
+            stats->packets.symbols, stats->packets.max_count, stats->packets.uncorrectable, stats->gaps,
+            stats->skipped + reader.fill);
+
+    return (stats->packets.uncorrectable > 0 || stats->gaps > 0) ? 2 : 0;
+}
+
+int main(int argc, char * argv[])
+{
+    if (argc == 2 && strcmp(argv[1], "send") == 0)
+        return send_stream();
+    if (argc == 2 && strcmp(argv[1], "recv") == 0)
+        return recv_stream();
+
+    fprintf(stderr, "Usage: %s send|recv\n", argv[0]);
+    return 1;
+}
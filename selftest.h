@@ -0,0 +1,434 @@
+#ifndef SELFTEST_H
+#define SELFTEST_H
+
+#include "encoder.h"
+#include "decoder.h"
+#include "interleave.h"
+
+/*
+ * ----------SELF TEST----------
+ *
+ * Randomised check of the encoders, decoders and kernels, e.g. to qualify a
+ * build, a compiler or a CPU. Every iteration checks, with every kernel set
+ * the CPU supports (gf_simd.h):
+ *  - default code: a random message of 1..kk symbols must get the same parity
+ *    as from the original encoder, encode_rs_ref() (zero padded);
+ *  - default code: 0..tt+4 random errors. Up to tt errors must be corrected
+ *    by decode_rs() and decode_wire() exactly as by the original decoder,
+ *    decode_rs_ref(). Beyond tt, a packet the original decoder rejects must
+ *    be rejected too; a rejected packet must be left as received and an
+ *    accepted one must be a codeword. Full length packets must give the same
+ *    result as the original decoder.
+ *  - default code: random errors and erasures with 2*e + f <= nn-kk must be
+ *    corrected by decode_rs_erasures();
+ *  - default code: a frame of random depth with a burst of up to depth*tt
+ *    bytes must be corrected by decode_frame_wire();
+ *  - default code: a transfer of up to 4*GF_BATCH packets with an error each,
+ *    shuffled, must be reassembled and unpacked; a lost packet must be
+ *    reported missing and a duplicate rejected, and a transfer with a
+ *    corrupted sequence number must be unpacked in index order;
+ *  - a random code (field, length, roots): its codewords and syndromes are
+ *    checked against evaluation with the field tables only, and correctable
+ *    and uncorrectable errata as above;
+ *  - both codes: a batch of up to 2*GF_BATCH codewords of random lengths
+ *    must get the same parity from the batch encoder as one by one.
+ *
+ * The inputs follow from the seed alone, and are the same for every kernel
+ * set, so a failure is reproduced with the same seed and iteration. The
+ * checks select kernel sets with gf_select() and must not run while other
+ * threads encode or decode; the active set is restored afterwards.
+ */
+
+struct self_test {
+
+    int checks;             // # of checks done
+    int failures;           // # of checks failed
+    const char * check;     // First failed check, its kernel set and iteration; NULL if none failed
+    const char * kernel;
+    int iteration;
+
+};
+
+typedef struct self_test self_test_t;
+
+// xorshift32, so that runs do not depend on (or disturb) rand()
+static inline unsigned int self_test_rand(unsigned int * rng)
+{
+    *rng ^= *rng << 13;
+    *rng ^= *rng >> 17;
+    *rng ^= *rng << 5;
+
+    return *rng;
+}
+
+static inline void self_test_expect(self_test_t * res, int ok, const char * check, const char * kernel, int it)
+{
+    res->checks++;
+    if (ok) return;
+
+    if (res->failures++ == 0)
+    {
+        res->check     = check;
+        res->kernel    = kernel;
+        res->iteration = it;
+    }
+}
+
+// Pick count distinct random positions out of 0..n-1 (count <= n)
+static inline void self_test_positions(unsigned int * rng, int * pos, int count, int n)
+{
+    register int i, j;
+
+    for (i = 0; i < count; i++)
+        do {
+            pos[i] = (int) (self_test_rand(rng) % n);
+            for (j = 0; j < i && pos[j] != pos[i]; j++) ;
+        } while (j < i);
+}
+
+/*
+ * Syndromes of the word with parity bb[0..np-1] and data[0..len-1] of code rs,
+ * s[i] = r(alpha**(prim*(fcr+i))), evaluated symbol by symbol with alpha_to[]
+ * and index_of[] only. Independent of the kernels and their tables.
+ */
+static inline void self_test_eval(const rs_codec_t * rs, const MSG_TYPE * data, int len, const MSG_TYPE * bb,
+                                  unsigned char * s)
+{
+    register int i, p;
+    int x, root, q = rs->q;
+
+    for (i = 0; i < rs->np; i++)
+    {
+        s[i] = 0;
+        root = (rs->par.prim * (rs->par.fcr + i)) % q;
+
+        for (p = 0; p < rs->np + len; p++)
+        {
+            x = (p < rs->np) ? bb[p] : data[p - rs->np];
+            if (x != 0)
+                s[i] ^= rs->alpha_to[(rs->index_of[x] + root * p) % q];
+        }
+    }
+}
+
+static inline int self_test_zero(const unsigned char * s, int n)
+{
+    register int i;
+    unsigned char any = 0;
+
+    for (i = 0; i < n; i++)
+        any |= s[i];
+
+    return any == 0;
+}
+
+// Compare the (shortened) codewords of two packets of F_length data symbols
+static inline int self_test_same(const packet_t * a, const packet_t * b, int F_length)
+{
+    return memcmp(a->data, b->data, F_length * sizeof(MSG_TYPE)) == 0 &&
+           memcmp(a->ECF, b->ECF, (nn-kk) * sizeof(MSG_TYPE)) == 0;
+}
+
+/*
+ * A batch of random codewords of up to k data symbols of code rs, encoded by
+ * rs_encode_batch() and one by one by rs_encode_buf()
+ */
+static inline void self_test_batch(self_test_t * res, unsigned int * rng, const rs_codec_t * rs, const char * kernel,
+                                   int it)
+{
+    static MSG_TYPE data[2*GF_BATCH][RS_MAX_NN], bb[2*GF_BATCH][RS_MAX_ROOTS], ref[RS_MAX_ROOTS];
+    const MSG_TYPE * dp[2*GF_BATCH];
+    MSG_TYPE * bp[2*GF_BATCH];
+    int len[2*GF_BATCH], n, c, i, ok = 1;
+
+    n = 1 + (int) (self_test_rand(rng) % (2*GF_BATCH));
+    for (c = 0; c < n; c++)
+    {
+        len[c] = (int) (self_test_rand(rng) % (rs->par.k + 1));
+        for (i = 0; i < len[c]; i++)
+            data[c][i] = (MSG_TYPE) (self_test_rand(rng) % (rs->q + 1));
+        dp[c] = data[c];
+        bp[c] = bb[c];
+    }
+
+    ok = (rs_encode_batch(rs, dp, len, bp, n) == 0);
+    for (c = 0; c < n && ok; c++)
+    {
+        rs_encode_buf(rs, data[c], len[c], ref);
+        ok = (memcmp(bb[c], ref, rs->np * sizeof(MSG_TYPE)) == 0);
+    }
+
+    self_test_expect(res, ok, "rs_encode_batch", kernel, it);
+}
+
+// Default code: encoder and decoders against encode_rs_ref() and decode_rs_ref()
+static inline void self_test_default(self_test_t * res, unsigned int * rng, const char * kernel, int it)
+{
+    const rs_codec_t * rs = rs_default_codec();
+    packet_t sent, recv, ref, bad;
+    MSG_TYPE buf[HEADER_SIZE + nn];
+    int pos[nn], len, e, f, i, r, r_ref, size;
+
+    // Random message, zero padded for encode_rs_ref()
+    memset(&sent, 0, sizeof(packet_t));
+    len = 1 + (int) (self_test_rand(rng) % kk);
+    write_header(sent.header, len, it);
+    for (i = 0; i < len; i++)
+        sent.data[i] = (MSG_TYPE) self_test_rand(rng);
+
+    ref = sent;
+    encode_rs(&sent);
+    encode_rs_ref(rs, &ref);
+    self_test_expect(res, memcmp(sent.ECF, ref.ECF, (nn-kk) * sizeof(MSG_TYPE)) == 0, "encode_rs", kernel, it);
+    self_test_expect(res, check_rs(&sent), "check_rs", kernel, it);
+
+    // Random errors in the shortened codeword, see recd_rs()
+    e   = (int) (self_test_rand(rng) % (tt+5));
+    bad = sent;
+    self_test_positions(rng, pos, e, (nn-kk) + len);
+    for (i = 0; i < e; i++)
+        *recd_rs(&bad, pos[i]) ^= (MSG_TYPE) (1 + self_test_rand(rng) % TYPE_MAX);
+
+    recv  = bad;
+    ref   = bad;
+    r     = decode_rs(&recv, NULL);
+    r_ref = decode_rs_ref(rs, &ref, NULL);
+
+    if (e <= tt)
+    {
+        self_test_expect(res, r_ref == e && self_test_same(&ref, &sent, len), "decode_rs_ref", kernel, it);
+        self_test_expect(res, r == e && self_test_same(&recv, &sent, len), "decode_rs", kernel, it);
+    }
+    else
+    {
+        if (r_ref < 0)
+            self_test_expect(res, r < 0, "decode_rs uncorrectable", kernel, it);
+        if (r < 0)
+            self_test_expect(res, self_test_same(&recv, &bad, len), "decode_rs rejected", kernel, it);
+        else
+            self_test_expect(res, r <= tt && check_rs(&recv), "decode_rs miscorrected", kernel, it);
+        if (len == kk)
+            self_test_expect(res, r == r_ref && (r < 0 || self_test_same(&recv, &ref, len)), "decode_rs full",
+                             kernel, it);
+    }
+
+    // The same packet decoded in wire format
+    size = serialize_packet(&bad, buf);
+    self_test_expect(res, decode_wire(buf, size, NULL) == r &&
+                          memcmp(&buf[HEADER_SIZE], recv.data, len * sizeof(MSG_TYPE)) == 0 &&
+                          memcmp(&buf[HEADER_SIZE + len], recv.ECF, (nn-kk) * sizeof(MSG_TYPE)) == 0,
+                     "decode_wire", kernel, it);
+
+    // Random erasures (of any value, including none) and errors, 2*e + f <= nn-kk
+    f    = 1 + (int) (self_test_rand(rng) % (nn-kk));
+    e    = (int) (self_test_rand(rng) % ((nn-kk-f)/2 + 1));
+    recv = sent;
+    self_test_positions(rng, pos, f + e, (nn-kk) + len);
+    for (i = 0; i < f + e; i++)
+        *recd_rs(&recv, pos[i]) ^= (i < f) ? (MSG_TYPE) self_test_rand(rng)
+                                           : (MSG_TYPE) (1 + self_test_rand(rng) % TYPE_MAX);
+
+    r = decode_rs_erasures(&recv, pos, f, NULL);
+    self_test_expect(res, r >= e && r <= f + e && self_test_same(&recv, &sent, len), "decode_rs_erasures",
+                     kernel, it);
+
+    self_test_batch(res, rng, rs, kernel, it);
+}
+
+// Default code: interleaved frame with a burst error
+static inline void self_test_frame(self_test_t * res, unsigned int * rng, const char * kernel, int it)
+{
+    static frame_t frame;
+    static MSG_TYPE data[RS_MAX_DEPTH*kk], buf[HEADER_SIZE + RS_MAX_DEPTH*nn];
+    int depth, size, wire, burst, start, i;
+
+    depth = 1 + (int) (self_test_rand(rng) % RS_MAX_DEPTH);
+    size  = 1 + (int) (self_test_rand(rng) % (depth*kk));
+    for (i = 0; i < size; i++)
+        data[i] = (MSG_TYPE) self_test_rand(rng);
+
+    fill_frame(&frame, data, size, depth, it);
+    wire = serialize_frame(&frame, buf);
+
+    // A burst of depth*tt bytes hits tt symbols of every codeword
+    burst = (int) (self_test_rand(rng) % (depth*tt + 1));
+    start = HEADER_SIZE + (int) (self_test_rand(rng) % (wire - HEADER_SIZE - burst + 1));
+    for (i = start; i < start + burst; i++)
+        buf[i] ^= (MSG_TYPE) (1 + self_test_rand(rng) % TYPE_MAX);
+
+    self_test_expect(res, decode_frame_wire(buf, wire, depth, NULL) >= 0 &&
+                          memcmp(&buf[HEADER_SIZE], frame.body, (wire - HEADER_SIZE) * sizeof(MSG_TYPE)) == 0,
+                     "decode_frame_wire", kernel, it);
+}
+
+// Default code: reassembly of a shuffled transfer with a lost and a duplicated packet
+static inline void self_test_reassembly(self_test_t * res, unsigned int * rng, const char * kernel, int it)
+{
+    static packet_t packs[4*GF_BATCH], sent[4*GF_BATCH];
+    static MSG_TYPE data[4*GF_BATCH*kk], msg[4*GF_BATCH*kk];
+    static _Atomic unsigned int received[REASSEMBLY_WORDS(4*GF_BATCH*kk)];
+    reassembly_t r;
+    packet_t tmp;
+    transfer_t transfer;
+    transfer_stats_t st;
+    int size, lost, missing, seq = -1, i, j;
+
+    size = 1 + (int) (self_test_rand(rng) % (4*GF_BATCH*kk));
+    for (i = 0; i < size; i++)
+        data[i] = (MSG_TYPE) self_test_rand(rng);
+
+    transfer = fill_transfer(packs, data, size);
+    for (i = transfer.size - 1; i > 0; i--)
+    {
+        j = (int) (self_test_rand(rng) % (i+1));
+        tmp = packs[i]; packs[i] = packs[j]; packs[j] = tmp;
+    }
+    memcpy(sent, packs, transfer.size * sizeof(packet_t));
+    lost = (int) (self_test_rand(rng) % transfer.size);
+
+    reassembly_init_static(&r, msg, size, received);
+    for (i = 0; i < transfer.size; i++)
+        if (i != lost)
+        {
+            *recd_rs(&packs[i], (int) (self_test_rand(rng) % nn)) ^= (MSG_TYPE) (1 + self_test_rand(rng) % TYPE_MAX);
+            reassembly_add(&r, &packs[i], NULL);
+        }
+
+    missing = reassembly_missing(&r, &seq, 1);
+    self_test_expect(res, !reassembly_complete(&r) && missing == 1 && seq == packet_seq(&sent[lost]),
+                     "reassembly_missing", kernel, it);
+
+    reassembly_add(&r, &packs[lost], NULL);
+    self_test_expect(res, reassembly_add(&r, &sent[lost], NULL) < 0 && r.duplicates == 1 && r.invalid == 0 &&
+                          reassembly_complete(&r) && memcmp(msg, data, size * sizeof(MSG_TYPE)) == 0,
+                     "reassembly_add", kernel, it);
+
+    reassembly_free(&r);
+
+    memcpy(packs, sent, transfer.size * sizeof(packet_t));
+    self_test_expect(res, unpack_transfer_to(&transfer, msg, size, &st) == size && st.misplaced == 0 &&
+                          st.missing == 0 && memcmp(msg, data, size * sizeof(MSG_TYPE)) == 0,
+                     "unpack_transfer_to", kernel, it);
+
+    // A corrupted sequence number, here a duplicate: back to index order
+    if (transfer.size > 1)
+    {
+        transfer = fill_transfer(packs, data, size);
+        j = (lost + 1) % transfer.size;
+        write_header(packs[lost].header, packs[lost].header[3], packet_seq(&packs[j]));
+        self_test_expect(res, unpack_transfer_to(&transfer, msg, size, &st) == size && st.misplaced == 1 &&
+                              st.missing == 1 && memcmp(msg, data, size * sizeof(MSG_TYPE)) == 0,
+                         "unpack_transfer_to misplaced", kernel, it);
+    }
+}
+
+// A random code, checked against self_test_eval()
+static inline void self_test_code(self_test_t * res, unsigned int * rng, const char * kernel, int it)
+{
+    static const int polys[RS_MAX_MM+1] = { 0, 0, 0x7, 0xB, 0x13, 0x25, 0x43, 0x89, 0x11D };
+    static rs_codec_t rs;
+    rs_params_t par;
+    MSG_TYPE data[RS_MAX_NN], bb[RS_MAX_ROOTS], rdata[RS_MAX_NN], rbb[RS_MAX_ROOTS];
+    unsigned char s[RS_MAX_ROOTS], s_ref[RS_MAX_ROOTS];
+    int pos[RS_MAX_NN], q, np, len, e, f, i, r;
+
+    // Field, length and roots; prim is drawn until it is coprime to q
+    par.m    = 2 + (int) (self_test_rand(rng) % (RS_MAX_MM-1));
+    par.poly = (par.m == 8 && (self_test_rand(rng) & 1)) ? 0x187 : polys[par.m];
+    q        = (1 << par.m) - 1;
+    np       = 2 + (int) (self_test_rand(rng) % (((q-1 < RS_MAX_ROOTS) ? q-1 : RS_MAX_ROOTS) - 1));
+    par.n    = np + 1 + (int) (self_test_rand(rng) % (q - np));
+    par.k    = par.n - np;
+    par.fcr  = (int) (self_test_rand(rng) % q);
+    do {
+        par.prim = 1 + (int) (self_test_rand(rng) % (q-1));
+    } while (rs_init(&rs, &par) != 0);
+
+    len = (int) (self_test_rand(rng) % (par.k + 1));
+    for (i = 0; i < len; i++)
+        data[i] = (MSG_TYPE) (self_test_rand(rng) % (q+1));
+
+    self_test_expect(res, rs_encode_buf(&rs, data, len, bb) == 0, "rs_encode_buf", kernel, it);
+    self_test_eval(&rs, data, len, bb, s_ref);
+    self_test_expect(res, self_test_zero(s_ref, np), "rs_encode_buf codeword", kernel, it);
+    self_test_batch(res, rng, &rs, kernel, it);
+
+    // Correctable errata, 2*e + f <= np
+    f = (int) (self_test_rand(rng) % (np + 1));
+    e = (int) (self_test_rand(rng) % ((np-f)/2 + 1));
+    memcpy(rdata, data, len * sizeof(MSG_TYPE));
+    memcpy(rbb, bb, np * sizeof(MSG_TYPE));
+    self_test_positions(rng, pos, f + e, np + len);
+    for (i = 0; i < f + e; i++)
+    {
+        MSG_TYPE * x = (pos[i] < np) ? &rbb[pos[i]] : &rdata[pos[i] - np];
+        *x ^= (MSG_TYPE) ((i < f) ? self_test_rand(rng) % (q+1) : 1 + self_test_rand(rng) % q);
+    }
+
+    rs_syndromes_buf(&rs, rdata, len, rbb, s);
+    self_test_eval(&rs, rdata, len, rbb, s_ref);
+    self_test_expect(res, memcmp(s, s_ref, np) == 0, "rs_syndromes_buf", kernel, it);
+
+    r = rs_decode_buf(&rs, rdata, len, rbb, pos, f, NULL);
+    self_test_expect(res, r >= e && memcmp(rdata, data, len * sizeof(MSG_TYPE)) == 0 &&
+                          memcmp(rbb, bb, np * sizeof(MSG_TYPE)) == 0, "rs_decode_buf", kernel, it);
+
+    // More errors than can be corrected, where the codeword is long enough
+    e = rs.t + 1 + (int) (self_test_rand(rng) % (rs.t + 1));
+    if (e > np + len) return;
+
+    memcpy(rdata, data, len * sizeof(MSG_TYPE));
+    memcpy(rbb, bb, np * sizeof(MSG_TYPE));
+    self_test_positions(rng, pos, e, np + len);
+    for (i = 0; i < e; i++)
+    {
+        MSG_TYPE * x = (pos[i] < np) ? &rbb[pos[i]] : &rdata[pos[i] - np];
+        *x ^= (MSG_TYPE) (1 + self_test_rand(rng) % q);
+    }
+
+    memcpy(data, rdata, len * sizeof(MSG_TYPE));
+    memcpy(bb, rbb, np * sizeof(MSG_TYPE));
+    r = rs_decode_buf(&rs, rdata, len, rbb, NULL, 0, NULL);
+    if (r < 0)
+        self_test_expect(res, memcmp(rdata, data, len * sizeof(MSG_TYPE)) == 0 &&
+                              memcmp(rbb, bb, np * sizeof(MSG_TYPE)) == 0, "rs_decode_buf rejected", kernel, it);
+    else
+    {
+        self_test_eval(&rs, rdata, len, rbb, s_ref);
+        self_test_expect(res, r <= rs.t && self_test_zero(s_ref, np), "rs_decode_buf miscorrected", kernel, it);
+    }
+}
+
+/*
+ * Run iterations iterations of the checks from seed (nonzero) with every
+ * supported kernel set and store the results in res. Returns the # of
+ * failed checks.
+ */
+static inline int rs_self_test(int iterations, unsigned int seed, self_test_t * res)
+{
+    register int i, it;
+    unsigned int rng;
+    const gf_kernels_t * active = gf_active();
+
+    memset(res, 0, sizeof(self_test_t));
+
+    for (i = 0; i < GF_KERNELS; i++)
+    {
+        if (!gf_supported(&gf_kernel_list[i])) continue;
+        gf_select(gf_kernel_list[i].name);
+
+        for (it = 0, rng = seed; it < iterations; it++)
+        {
+            self_test_default(res, &rng, gf_kernel_list[i].name, it);
+            self_test_frame(res, &rng, gf_kernel_list[i].name, it);
+            self_test_reassembly(res, &rng, gf_kernel_list[i].name, it);
+            self_test_code(res, &rng, gf_kernel_list[i].name, it);
+        }
+    }
+
+    gf_select(active->name);
+
+    return res->failures;
+}
+
+#endif //SELFTEST_H
@@ -0,0 +1,398 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <unistd.h>
+#include <errno.h>
+
+#include "encoder.h"
+#include "decoder.h"
+
+/*
+ * ----------PACKET STREAMS----------
+ *
+ * Sends packets over a byte stream (file descriptor, pipe or socket) and
+ * receives them from one, e.g. a continuous downlink. Every packet is sent in
+ * wire format (see serialize_packet()) behind a sync marker, the CCSDS
+ * attached sync marker 0x1ACFFC1D:
+ *
+ *      1A CF FC 1D | header | F_length data bytes | nn-kk ECF bytes
+ *
+ * The bytes after the marker are XORed with the CCSDS pseudo-random sequence
+ * (x^8+x^7+x^5+x^3+1, see stream_pn_init()). Besides keeping long runs of
+ * equal bytes off the link, this matters for resynchronisation: the code is
+ * cyclic, so without it a window that is off by a few bytes (dropped in a
+ * marker or header) holds a shifted codeword, which the decoder would
+ * "correct" into a valid packet with the wrong data.
+ *
+ * The reader finds the packets by their marker, in a fixed buffer of
+ * STREAM_BUFFER bytes, and decodes each one in place as soon as it is
+ * complete, so memory use is constant and a packet is delivered as soon as
+ * its last byte has arrived. A marker is accepted with up to
+ * STREAM_SYNC_ERRORS bit errors. The header is not protected by the code: a
+ * packet that cannot be decoded (too many errors, a corrupted length, or
+ * bytes dropped on the link) is reported, and the reader then searches for
+ * the next marker from the byte after this one, not after the packet. After
+ * dropped bytes it is therefore back in sync at the next packet.
+ *
+ * Gaps in the sequence numbers (header_seq()) of the decoded packets are
+ * counted, so lost packets are detected, i.e. those lost with their marker.
+ * Packets found in a gap that could not be decoded are counted as
+ * uncorrectable only, so every packet is counted once. A sequence number
+ * corrupted on the link (the header is not protected) would show as a gap of
+ * up to SEQ_LIMIT-1 packets, so a gap is only counted once it is confirmed:
+ * once STREAM_CONFIRM packets in a row follow on each other after it. When a
+ * packet follows on the packets before the gap instead, the numbers after it
+ * were corrupted, and the gap is dropped. For the same reason the reader only
+ * locks on to the sequence at the first STREAM_CONFIRM decoded packets in a
+ * row; as for a reader that joins a stream midway, packets lost before then
+ * are not counted, and neither are those in a gap not confirmed by the end
+ * of the stream.
+ *
+ * Usage:
+ *      stream_writer_init(&writer, fd);
+ *      stream_write(&writer, data, size);          // repeatedly
+ *      stream_writer_flush(&writer);               // final (partial) packet
+ *
+ *      stream_reader_init(&reader, fd, on_packet, user);
+ *      while (stream_read(&reader) > 0) ;          // or stream_feed() bytes from elsewhere
+ *
+ * A reader or writer is used by a single thread.
+ */
+
+#define STREAM_SYNC_SIZE    4
+#define STREAM_SYNC         0x1ACFFC1Du
+#define STREAM_SYNC_ERRORS  2       // Bit errors accepted in a sync marker
+
+#define STREAM_PACKET       (STREAM_SYNC_SIZE + HEADER_SIZE + nn)   // Largest packet on the stream
+#define STREAM_BUFFER       (2 * STREAM_PACKET)
+#define STREAM_PN_PERIOD    255     // Period of the pseudo-random sequence
+#define STREAM_CONFIRM      4       // Packets in a row that confirm a gap in the sequence numbers
+
+/*
+ * Called by the reader for every packet found on the stream, with the packet
+ * in wire format at buf, decoded in place (see wire_view()) if
+ * status->success, or as received (but derandomised) otherwise. buf is only
+ * valid during the call.
+ */
+typedef void (*stream_packet_t)(const MSG_TYPE * buf, const decode_status_t * status, void * user);
+
+struct stream_stats {
+
+    transfer_stats_t packets;   // Decoding statistics of the packets found
+    int gaps;                   // # of packets lost: sequence numbers missing between decoded packets, less
+                                // the packets found between them that could not be decoded (confirmed gaps)
+    long long skipped;          // # of bytes outside the packets that were decoded
+
+};
+
+typedef struct stream_stats stream_stats_t;
+
+struct stream_reader {
+
+    int fd;
+    MSG_TYPE buf[STREAM_BUFFER];
+    int fill;                   // # of bytes in buf
+    MSG_TYPE pn[STREAM_PN_PERIOD];
+
+    int seq;                    // Sequence number expected next, -1 until locked on, see stream_sequence()
+    int alt;                    // Expected next if the numbers since the last confirmed packet were corrupted
+    int run;                    // # of packets in a row that followed on each other
+    int pending;                // # of packets lost since the last confirmed packet, not yet counted
+    int failed;                 // # of packets not decoded since the last decoded packet
+    int alt_failed;             // # of packets not decoded since the last confirmed packet
+    stream_stats_t stats;
+
+    stream_packet_t on_packet;
+    void * user;
+
+};
+
+typedef struct stream_reader stream_reader_t;
+
+struct stream_writer {
+
+    int fd;
+    int error;                  // errno of the first failed write, 0 if none
+    encode_stream_t encoder;
+    MSG_TYPE pn[STREAM_PN_PERIOD];
+
+};
+
+typedef struct stream_writer stream_writer_t;
+
+// One period of the CCSDS pseudo-random sequence, starting FF 48 0E C0
+static inline void stream_pn_init(MSG_TYPE * pn)
+{
+    unsigned int state = 0xFF, bit;
+    register int i, j;
+
+    for (i = 0; i < STREAM_PN_PERIOD; i++)
+    {
+        pn[i] = 0;
+        for (j = 0; j < 8; j++)
+        {
+            pn[i] = (MSG_TYPE) ((pn[i] << 1) | (state & 1));
+            bit   = (state ^ (state >> 3) ^ (state >> 5) ^ (state >> 7)) & 1;
+            state = (state >> 1) | (bit << 7);
+        }
+    }
+}
+
+// XOR the size bytes after a marker with the sequence; applied twice, this restores them
+static inline void stream_randomize(const MSG_TYPE * pn, MSG_TYPE * buf, int size)
+{
+    register int i;
+
+    for (i = 0; i < size; i++)
+        buf[i] ^= pn[i % STREAM_PN_PERIOD];
+}
+
+/*
+ * WRITER
+ */
+
+// Write all size bytes of buf to fd. Returns 0, or -1 with errno set.
+static inline int stream_write_all(int fd, const MSG_TYPE * buf, int size)
+{
+    ssize_t n;
+
+    while (size > 0)
+    {
+        n = write(fd, buf, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+
+        buf  += n;
+        size -= (int) n;
+    }
+
+    return 0;
+}
+
+// emit_packet_t of the writer: sends the marker and the packet with a single write
+static inline void stream_emit(const packet_t * packet, void * user)
+{
+    stream_writer_t * writer = (stream_writer_t *) user;
+    MSG_TYPE buf[STREAM_PACKET];
+    int size;
+
+    if (writer->error) return;
+
+    buf[0] = (MSG_TYPE) (STREAM_SYNC >> 24);
+    buf[1] = (MSG_TYPE) (STREAM_SYNC >> 16);
+    buf[2] = (MSG_TYPE) (STREAM_SYNC >> 8);
+    buf[3] = (MSG_TYPE) STREAM_SYNC;
+    size   = serialize_packet(packet, &buf[STREAM_SYNC_SIZE]);
+    stream_randomize(writer->pn, &buf[STREAM_SYNC_SIZE], size);
+    size  += STREAM_SYNC_SIZE;
+
+    if (stream_write_all(writer->fd, buf, size) != 0)
+        writer->error = errno;
+}
+
+static inline void stream_writer_init(stream_writer_t * writer, int fd)
+{
+    writer->fd    = fd;
+    writer->error = 0;
+    stream_pn_init(writer->pn);
+    encode_stream_init(&(writer->encoder), stream_emit, writer);
+}
+
+/*
+ * Frame size bytes of data into packets; every packet is sent as soon as it
+ * is full. Returns 0, or -1 if a write failed (errno in writer->error).
+ */
+static inline int stream_write(stream_writer_t * writer, const MSG_TYPE * data, int size)
+{
+    encode_stream_write(&(writer->encoder), data, size);
+    return writer->error ? -1 : 0;
+}
+
+// Send the last, partial packet, see stream_write().
+static inline int stream_writer_flush(stream_writer_t * writer)
+{
+    encode_stream_flush(&(writer->encoder));
+    return writer->error ? -1 : 0;
+}
+
+/*
+ * READER
+ */
+
+static inline void stream_reader_init(stream_reader_t * reader, int fd, stream_packet_t on_packet, void * user)
+{
+    reader->fd         = fd;
+    reader->fill       = 0;
+    stream_pn_init(reader->pn);
+    reader->seq        = -1;
+    reader->alt        = -1;
+    reader->run        = 0;
+    reader->pending    = 0;
+    reader->failed     = 0;
+    reader->alt_failed = 0;
+    reader->on_packet  = on_packet;
+    reader->user       = user;
+    memset(&(reader->stats), 0, sizeof(stream_stats_t));
+}
+
+// 1 if there is a sync marker at buf, with up to STREAM_SYNC_ERRORS bit errors
+static inline int stream_sync(const MSG_TYPE * buf)
+{
+    unsigned int word = ((unsigned int) buf[0] << 24) | ((unsigned int) buf[1] << 16) |
+                        ((unsigned int) buf[2] << 8) | buf[3];
+
+    return __builtin_popcount(word ^ STREAM_SYNC) <= STREAM_SYNC_ERRORS;
+}
+
+/*
+ * Count the packets lost before a decoded packet with number seq: the gap in
+ * the sequence numbers, less the packets found in it that could not be
+ * decoded. Gaps are pending until STREAM_CONFIRM packets in a row follow on
+ * each other; the last of them is confirmed, and so are the numbers before
+ * it. If a packet follows on the last confirmed packet instead (seq from
+ * alt, with a smaller gap), the numbers in between were corrupted and their
+ * gaps are dropped. Until it has locked on, the reader only counts the
+ * packets in a row.
+ */
+static inline void stream_sequence(stream_reader_t * reader, int seq)
+{
+    int gap = (seq - reader->seq) & SEQ_MASK, alt_gap = (seq - reader->alt) & SEQ_MASK;
+    int failed = reader->failed;
+
+    reader->failed = 0;
+
+    if (reader->seq < 0)
+    {
+        reader->run = (seq == reader->alt) ? reader->run + 1 : 1;
+        reader->alt = (seq + 1) & SEQ_MASK;
+        if (reader->run >= STREAM_CONFIRM)
+            reader->seq = reader->alt;                  // Locked on
+        reader->alt_failed = 0;
+        return;
+    }
+
+    if (gap == 0)
+        reader->run++;
+    else
+    {
+        if (alt_gap < gap)
+            reader->pending = alt_gap - ((reader->alt_failed < alt_gap) ? reader->alt_failed : alt_gap);
+        else
+            reader->pending += gap - ((failed < gap) ? failed : gap);
+        reader->run = 1;
+    }
+
+    reader->seq = (seq + 1) & SEQ_MASK;
+    reader->alt = (reader->alt + 1) & SEQ_MASK;
+
+    if (reader->run >= STREAM_CONFIRM)
+    {
+        reader->stats.gaps += reader->pending;
+        reader->pending     = 0;
+        reader->alt_failed  = 0;
+        reader->alt         = reader->seq;
+    }
+}
+
+/*
+ * Decode and deliver every complete packet in the buffer, and drop the bytes
+ * that precede the first packet still incomplete.
+ */
+static inline void stream_process(stream_reader_t * reader)
+{
+    MSG_TYPE * packet;
+    decode_status_t st;
+    int pos = 0, skip = 0, F_length, size;
+
+    while (reader->fill - pos >= STREAM_SYNC_SIZE + HEADER_SIZE)
+    {
+        packet   = &(reader->buf[pos + STREAM_SYNC_SIZE]);
+        F_length = packet[3] ^ reader->pn[3];
+
+        if (!stream_sync(&(reader->buf[pos])) || F_length > kk)
+        {
+            pos++;
+            skip++;
+            continue;
+        }
+
+        size = HEADER_SIZE + F_length + (nn-kk);
+        if (reader->fill - pos < STREAM_SYNC_SIZE + size)
+            break;                                      // Wait for the rest of the packet
+
+        stream_randomize(reader->pn, packet, size);
+        decode_wire(packet, size, &st);
+        count_status(&(reader->stats.packets), &st);
+
+        if (st.success)
+            stream_sequence(reader, header_seq(packet));
+
+        reader->on_packet(packet, &st, reader->user);
+
+        // Resynchronise from the next byte if the packet could not be decoded, see above
+        if (st.success)
+        {
+            pos += STREAM_SYNC_SIZE + size;
+            reader->stats.skipped += skip;
+            skip = 0;
+        }
+        else
+        {
+            stream_randomize(reader->pn, packet, size);     // Back to the bytes received
+            reader->failed++;
+            reader->alt_failed++;
+            pos++;
+            skip++;
+        }
+    }
+
+    reader->stats.skipped += skip;
+    reader->fill -= pos;
+    memmove(reader->buf, &(reader->buf[pos]), reader->fill * sizeof(MSG_TYPE));
+}
+
+/*
+ * Process size bytes received from the stream, e.g. from the caller's own
+ * socket loop, delivering the packets completed by them.
+ */
+static inline void stream_feed(stream_reader_t * reader, const MSG_TYPE * data, int size)
+{
+    register int n;
+
+    while (size > 0)
+    {
+        n = STREAM_BUFFER - reader->fill;
+        if (n > size) n = size;
+
+        memcpy(&(reader->buf[reader->fill]), data, n * sizeof(MSG_TYPE));
+        reader->fill += n;
+        data += n;
+        size -= n;
+
+        stream_process(reader);
+    }
+}
+
+/*
+ * Read whatever is available from the file descriptor (a single read()) and
+ * deliver the packets completed by it. Returns the # of bytes read, 0 at the
+ * end of the stream, or -1 with errno set (e.g. EAGAIN on a non-blocking
+ * descriptor).
+ */
+static inline int stream_read(stream_reader_t * reader)
+{
+    ssize_t n;
+
+    do {
+        n = read(reader->fd, &(reader->buf[reader->fill]), (STREAM_BUFFER - reader->fill) * sizeof(MSG_TYPE));
+    } while (n < 0 && errno == EINTR);
+
+    if (n <= 0) return (int) n;
+
+    reader->fill += (int) n;
+    stream_process(reader);
+
+    return (int) n;
+}
+
+#endif //STREAM_H
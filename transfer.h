@@ -1,10 +1,23 @@
 #ifndef TRANSFER_H
 #define TRANSFER_H
 
-#define HEADER_SIZE 5
+#include "rs.h"
+#include "profile.h"
 
-// Commented out for now, might need to be used when transferring data serially
-//#pragma pack(1) // https://stackoverflow.com/questions/3318410/pragma-pack-effect
+#define HEADER_SIZE 7
+
+/*
+ * Frame sequence numbers are SEQ_BITS wide: header[4] holds the low 8 bits as
+ * in PSS-04-107, header[5..6] (an extension) the rest. A transfer of up to
+ * SEQ_LIMIT packets (over 3.7 GB, more than an int size can describe) is
+ * therefore numbered without wrapping; longer streams wrap modulo SEQ_LIMIT.
+ */
+#define SEQ_BITS    24
+#define SEQ_LIMIT   (1 << SEQ_BITS)
+#define SEQ_MASK    (SEQ_LIMIT - 1)
+
+// The packet is laid out as sent: no padding between or after the fields, for any MSG_TYPE
+#pragma pack(push, 1) // https://stackoverflow.com/questions/3318410/pragma-pack-effect
 
 struct packet {
 
@@ -35,9 +48,12 @@ struct packet {
      *  - Virtual channel ID: 6 bits        | 00111111 | 0x3F
      *  - Reserved field B: 2 bits          | 11000000 | 0xC0
      *
-     * Last two bytes:
+     * Fourth and fifth byte:
      *  - Frame length: 8 bits              | 11111111 | 0xFF
      *  - Frame sequence number: 8 bits     | 11111111 | 0xFF
+     *
+     * Last two bytes (extension, not in PSS-04-107):
+     *  - Frame sequence number, bits 8..23, most significant byte first
      */
 
     MSG_TYPE header[HEADER_SIZE];
@@ -45,6 +61,9 @@ struct packet {
     /*
      * ---DATA---
      *
+     * Only the first F_length = header[3] bytes are used. Short frames are
+     * encoded with a shortened code: the rest of data[] is virtual zero
+     * padding, which is neither initialised, encoded, decoded nor sent.
      */
 
     MSG_TYPE data[kk];
@@ -58,8 +77,12 @@ struct packet {
 
 };
 
+#pragma pack(pop)
+
 typedef struct packet packet_t;
 
+_Static_assert(sizeof(packet_t) == (HEADER_SIZE + nn) * sizeof(MSG_TYPE), "packet_t is not packed");
+
 /*
  * Transfer struct, enables intuitive overview of data, along with the size
  * in data packets enclosed within.
@@ -74,109 +97,443 @@ struct transfer {
 
 typedef struct transfer transfer_t;
 
-void encode_rs(packet_t * packet);
-void decode_rs(packet_t * packet);
+/*
+ * Result of decoding a single packet, filled in by decode_rs().
+ *
+ * Error locations are codeword positions, as used by decode_rs():
+ * positions 0..nn-kk-1 are ECF[0..nn-kk-1] and positions nn-kk..nn-1 are
+ * data[0..kk-1] (for other codes, see rs_decode_buf()). The magnitudes are
+ * the values XORed into the received symbols at those locations. Up to tt
+ * errors, or up to 2*tt erasures, can be corrected; erased symbols that turn
+ * out to be correct are not counted.
+ */
+
+struct decode_status {
+
+    int success;            // 1 if the packet is a valid codeword (after correction)
+    int syn_zero;           // 1 if all syndromes were zero: received without errors
+    int count;              // # of corrected symbols
+    unsigned char loc[RS_MAX_ROOTS];    // Error locations, loc[0..count-1]
+    MSG_TYPE mag[RS_MAX_ROOTS];         // Error magnitudes, mag[0..count-1]
+
+};
+
+typedef struct decode_status decode_status_t;
+
+/*
+ * Decoding statistics of a transfer, e.g. to drop bad frames or to monitor
+ * the link quality.
+ */
+
+struct transfer_stats {
+
+    int packets;            // # of packets decoded
+    int clean;              // # of packets received without errors
+    int corrected;          // # of packets with errors that have been corrected
+    int uncorrectable;      // # of packets with more than tt errors, left as received
+    int symbols;            // Total # of corrected symbols
+    int max_count;          // Highest # of corrected symbols in a single packet
+
+    // unpack_transfer_to() only: the packets are then reassembled in index order if either is nonzero
+    int misplaced;          // # of packets whose sequence number is out of range, a duplicate or does not fit their length
+    int missing;            // # of sequence numbers of the transfer that no packet has
+
+};
+
+typedef struct transfer_stats transfer_stats_t;
 
 /*
- * FILL DATA PACKETS
+ * Write the header of a packet (or frame, see interleave.h). The target
+ * information bytes are placeholders for now, frame length and sequence
+ * number (modulo SEQ_LIMIT) are set from the arguments.
  */
+static inline void write_header(MSG_TYPE * header, const int F_length, const int seq)
+{
+    // Target information bytes - placeholder: these are the bitmasks.
+    header[0]  = 0x03u; // 00000011
+    header[0] |= 0x04u; // 00000100
+    header[0] |= 0x08u; // 00001000
+    header[0] |= 0x18u; // 00110000
+    header[0] |= 0xC0u; // 11000000
+    header[1]  = 0xFFu; // 11111111
+    header[2]  = 0x3Fu; // 00111111
+    header[2] |= 0xC0u; // 11000000
+
+    header[3] = (MSG_TYPE) F_length;   // Frame length
+    header[4] = (MSG_TYPE) seq;        // Frame sequence number
+    header[5] = (MSG_TYPE) (seq >> 16);
+    header[6] = (MSG_TYPE) (seq >> 8);
+}
 
-void encode_transfer(transfer_t * transfer)
+// Frame sequence number of a header, 0..SEQ_LIMIT-1
+static inline int header_seq(const MSG_TYPE * header)
 {
-    // Error correction field
-    for (int i = 0; i < transfer->size; i++)
-        encode_rs(&(transfer->packs[i]));
+    return (header[5] << 16) | (header[6] << 8) | header[4];
 }
 
-transfer_t gen_transfer(const MSG_TYPE * data, const int size)
+static inline int packet_seq(const packet_t * packet)
 {
-    register int i;
+    return header_seq(packet->header);
+}
 
-    transfer_t transfer;
+static inline void fill_header(packet_t * packet, const int F_length, const int seq)
+{
+    write_header(packet->header, F_length, seq);
+}
 
-    transfer.size   = size/kk + (size % kk != 0); // # of packets required to store message
-    transfer.packs  = malloc(transfer.size * sizeof(packet_t));
+/*
+ * WIRE FORMAT
+ *
+ * On the link a packet takes HEADER_SIZE + F_length + (nn-kk) bytes: the
+ * header, the F_length data bytes and the ECF. The zero padding of a short
+ * frame is not sent; the receiver knows F_length from the header.
+ */
 
-    //printf("Generating %i packets...\n", transfer.size);
+static inline int packet_wire_size(const packet_t * packet)
+{
+    return HEADER_SIZE + packet->header[3] + (nn-kk);
+}
 
+/*
+ * Write a packet to buf in wire format. buf must hold packet_wire_size()
+ * bytes. Returns the number of bytes written.
+ */
+static inline int serialize_packet(const packet_t * packet, MSG_TYPE * buf)
+{
+    int F_length = packet->header[3];
+
+    memcpy(buf, packet->header, HEADER_SIZE * sizeof(MSG_TYPE));
+    memcpy(&buf[HEADER_SIZE], packet->data, F_length * sizeof(MSG_TYPE));
+    memcpy(&buf[HEADER_SIZE + F_length], packet->ECF, (nn-kk) * sizeof(MSG_TYPE));
+
+    return HEADER_SIZE + F_length + (nn-kk);
+}
+
+/*
+ * Read a packet in wire format from the size bytes in buf. Returns the number
+ * of bytes read, or -1 if buf does not hold a whole packet or the frame
+ * length is over kk.
+ */
+static inline int deserialize_packet(packet_t * packet, const MSG_TYPE * buf, int size)
+{
     int F_length;
 
-    /*
-     * Fill data packet(s)
-     */
+    if (size < HEADER_SIZE) return -1;
 
-    for (i = 0; i < transfer.size; i++)
-    {
-        // Target information bytes - placeholder: these are the bitmasks.
-        transfer.packs[i].header[0] |= 0x03u; // 00000011
-        transfer.packs[i].header[0] |= 0x04u; // 00000100
-        transfer.packs[i].header[0] |= 0x08u; // 00001000
-        transfer.packs[i].header[0] |= 0x18u; // 00110000
-        transfer.packs[i].header[0] |= 0xC0u; // 11000000
-        transfer.packs[i].header[1] |= 0xFFu; // 11111111
-        transfer.packs[i].header[2] |= 0x3Fu; // 00111111
-        transfer.packs[i].header[2] |= 0xC0u; // 11000000
-
-        F_length = ((size - (i+1)*kk) < 0) ? (size % kk) : kk; // Frame length
-        //printf("Frame Length packet[%i] = %d\n", i, F_length);
-
-        transfer.packs[i].header[3] = (MSG_TYPE) F_length;
-        transfer.packs[i].header[4] = (MSG_TYPE) i; // Frame sequence number
-
-        for (int j = 0; j < F_length; j++)
-            transfer.packs[i].data[j] = data[j+i*kk];
-
-        // Pad packet
-        if (F_length < kk)
-            for (int j = F_length; j < kk; j++)
-                transfer.packs[i].data[j] = 0;
-
-        // Generate ECF for all packets.
-        encode_transfer(&transfer);
-    }
+    F_length = buf[3];
+    if (F_length > kk || size < HEADER_SIZE + F_length + (nn-kk)) return -1;
+
+    memcpy(packet->header, buf, HEADER_SIZE * sizeof(MSG_TYPE));
+    memcpy(packet->data, &buf[HEADER_SIZE], F_length * sizeof(MSG_TYPE));
+    memcpy(packet->ECF, &buf[HEADER_SIZE + F_length], (nn-kk) * sizeof(MSG_TYPE));
 
-    return transfer;
+    return HEADER_SIZE + F_length + (nn-kk);
 }
 
-void decode_transfer(transfer_t * transfer)
+// # of packets needed for a message of size bytes, e.g. to size a packet pool
+#define TRANSFER_PACKETS(size) ((size)/kk + ((size) % kk != 0))
+
+/*
+ * PACKET POOL
+ *
+ * gen_transfer() and unpack_transfer() allocate on every call. A packet pool
+ * is a reserve of packets set aside once, from which packet_pool_transfer()
+ * (in encoder.h) takes transfers by just moving up the top of the pool. All
+ * of them are given back at once by packet_pool_reset(), after which their
+ * packets are reused. The reserve is allocated by packet_pool_init(), or
+ * supplied by the caller with packet_pool_init_static(), e.g. a static array
+ * sized with TRANSFER_PACKETS().
+ *
+ * With RS_NO_HEAP defined, the functions that allocate memory (gen_transfer(),
+ * unpack_transfer(), packet_pool_init(), the codec cache and their frame
+ * versions in interleave.h) are left out, so that a build that uses static
+ * pools, static codecs (RS_STATIC_TABLES) and unpack_transfer_to() cannot
+ * touch the heap on its encode/decode path. (parallel.h and pipeline.h only
+ * allocate in thread_pool_init() and pipeline_init().)
+ *
+ * Usage:
+ *      static packet_t packs[TRANSFER_PACKETS(MAX_MSG_SIZE)];
+ *      packet_pool_t pool;
+ *      packet_pool_init_static(&pool, packs, TRANSFER_PACKETS(MAX_MSG_SIZE));
+ *      if (packet_pool_transfer(&pool, &transfer, msg, size) == 0) ...
+ *      packet_pool_reset(&pool);
+ *
+ * A pool is not thread safe: use one per thread, or lock around it.
+ */
+
+struct packet_pool {
+
+    packet_t * packs;
+    int capacity;       // # of packets in the pool
+    int used;           // # of packets handed out since the last reset
+    int owned;          // 1 if packs was allocated by packet_pool_init()
+
+};
+
+typedef struct packet_pool packet_pool_t;
+
+static inline void packet_pool_init_static(packet_pool_t * pool, packet_t * packs, int capacity)
+{
+    pool->packs    = packs;
+    pool->capacity = capacity;
+    pool->used     = 0;
+    pool->owned    = 0;
+}
+
+#ifndef RS_NO_HEAP
+// Reserve capacity packets. Returns 0 on success, -1 on failure.
+static inline int packet_pool_init(packet_pool_t * pool, int capacity)
+{
+    packet_t * packs = malloc(capacity * sizeof(packet_t));
+
+    if (packs == NULL) return -1;
+
+    packet_pool_init_static(pool, packs, capacity);
+    pool->owned = 1;
+
+    return 0;
+}
+#endif
+
+static inline void packet_pool_free(packet_pool_t * pool)
+{
+#ifndef RS_NO_HEAP
+    if (pool->owned) free(pool->packs);
+#endif
+    packet_pool_init_static(pool, NULL, 0);
+}
+
+// Give back all packets handed out; transfers taken from the pool are no longer valid.
+static inline void packet_pool_reset(packet_pool_t * pool)
+{
+    pool->used = 0;
+}
+
+// Take n packets from the pool, NULL if there are not enough left.
+static inline packet_t * packet_pool_alloc(packet_pool_t * pool, int n)
+{
+    packet_t * packs;
+
+    if (n < 0 || n > pool->capacity - pool->used) return NULL;
+
+    packs       = &(pool->packs[pool->used]);
+    pool->used += n;
+
+    return packs;
+}
+
+// Add the status of a decoded packet to the statistics
+static inline void count_status(transfer_stats_t * stats, const decode_status_t * status)
+{
+    stats->packets++;
+    if (status->syn_zero)       stats->clean++;
+    else if (status->success)   stats->corrected++;
+    else                        stats->uncorrectable++;
+
+    stats->symbols += status->count;
+    if (status->count > stats->max_count) stats->max_count = status->count;
+}
+
+// Add the statistics in src to those in dst
+static inline void merge_stats(transfer_stats_t * dst, const transfer_stats_t * src)
+{
+    dst->packets        += src->packets;
+    dst->clean          += src->clean;
+    dst->corrected      += src->corrected;
+    dst->uncorrectable  += src->uncorrectable;
+    dst->symbols        += src->symbols;
+    if (src->max_count > dst->max_count) dst->max_count = src->max_count;
+    dst->misplaced      += src->misplaced;
+    dst->missing        += src->missing;
+}
+
+/*
+ * ZERO-COPY REASSEMBLY
+ *
+ * Instead of copying the message out of the packets (unpack_transfer()), the
+ * data of every packet can be handed out as a view: a pointer into the packet
+ * and a length, e.g. for writev() or a parser. Views are valid as long as the
+ * packets or receive buffers they point into.
+ */
+
+struct data_view {
+
+    const MSG_TYPE * data;
+    int size;
+
+};
+
+typedef struct data_view data_view_t;
+
+// View of the data of a packet
+static inline data_view_t packet_view(const packet_t * packet)
+{
+    data_view_t view = { packet->data, packet->header[3] };
+    return view;
+}
+
+// View of the data of a packet in wire format, see serialize_packet()
+static inline data_view_t wire_view(const MSG_TYPE * buf)
+{
+    data_view_t view = { &buf[HEADER_SIZE], buf[3] };
+    return view;
+}
+
+/*
+ * REASSEMBLY
+ *
+ * unpack_transfer() needs the whole transfer before it starts. A reassembly
+ * instead takes the packets of a message of known size one at a time, as
+ * they arrive, in any order and from any number of threads at once (e.g.
+ * reassemble_transfer_mt() in parallel.h): every packet is decoded in place
+ * (reassembly_add(), in decoder.h) and its data copied straight to its
+ * offset seq*kk in the message, so the message is complete as soon as its
+ * last missing packet has landed.
+ *
+ * The packets placed are marked in a bitmap of REASSEMBLY_WORDS(size) words.
+ * A packet is rejected, and not marked, if it is uncorrectable, if its
+ * number is outside the message or its frame length does not match its
+ * place (a corrupted header), or if its number has been placed already (a
+ * duplicate). The numbers still missing, e.g. to request them again, are
+ * listed by reassembly_missing().
+ *
+ * The bitmap is allocated by reassembly_init(), or supplied by the caller
+ * with reassembly_init_static(), as for a packet pool.
+ *
+ * Usage:
+ *      reassembly_init(&r, msg, size);
+ *      reassembly_add(&r, &packet, NULL);          // for every packet received
+ *      if (!reassembly_complete(&r)) missing = reassembly_missing(&r, seqs, max);
+ *      reassembly_free(&r);
+ */
+
+#define REASSEMBLY_WORDS(size) ((TRANSFER_PACKETS(size) + 31) / 32)
+
+struct reassembly {
+
+    MSG_TYPE * msg;
+    int size;                           // Size of the message in bytes
+    int packets;                        // # of packets of the message, TRANSFER_PACKETS(size)
+    _Atomic unsigned int * received;    // Bit seq%32 of word seq/32 is set once packet seq is placed
+    int owned;                          // 1 if received was allocated by reassembly_init()
+
+    _Atomic int placed;                 // # of packets placed
+    _Atomic int duplicates;             // # of packets rejected because they were placed already
+    _Atomic int invalid;                // # of packets rejected as uncorrectable or out of place
+
+};
+
+typedef struct reassembly reassembly_t;
+
+static inline void reassembly_init_static(reassembly_t * r, MSG_TYPE * msg, int size, _Atomic unsigned int * received)
 {
     register int i;
-    //printf("Decoding %i data packets...\n", transfer->size);
 
-    for (i = 0; i < transfer->size; i++)
-        decode_rs(&(transfer->packs[i]));
+    r->msg      = msg;
+    r->size     = size;
+    r->packets  = TRANSFER_PACKETS(size);
+    r->received = received;
+    r->owned    = 0;
+
+    for (i = 0; i < REASSEMBLY_WORDS(size); i++)
+        atomic_init(&(received[i]), 0);
+    atomic_init(&(r->placed), 0);
+    atomic_init(&(r->duplicates), 0);
+    atomic_init(&(r->invalid), 0);
+}
+
+#ifndef RS_NO_HEAP
+// Reassemble a message of size bytes into msg[]. Returns 0 on success, -1 on failure.
+static inline int reassembly_init(reassembly_t * r, MSG_TYPE * msg, int size)
+{
+    _Atomic unsigned int * received = malloc((REASSEMBLY_WORDS(size) + 1) * sizeof(unsigned int));   // Never malloc(0)
+
+    if (received == NULL) return -1;
+
+    reassembly_init_static(r, msg, size, received);
+    r->owned = 1;
 
+    return 0;
 }
+#endif
 
-MSG_TYPE * unpack_transfer(transfer_t * transfer)
+static inline void reassembly_free(reassembly_t * r)
 {
-    register int i, j, N = 0;
+#ifndef RS_NO_HEAP
+    if (r->owned) free((void *) r->received);
+#endif
+    r->received = NULL;
+    r->owned    = 0;
+}
 
-    decode_transfer(transfer);
+/*
+ * Place F_length bytes of (decoded) data as packet seq of the message.
+ * Returns 0 if it has been placed, -1 if it is rejected, see above.
+ */
+static inline int reassembly_place_seq(reassembly_t * r, int seq, int F_length, const MSG_TYPE * data)
+{
+    unsigned int bit;
 
-    // Determine message size
-    for (i = 0; i<transfer->size; i++)
-        N += transfer->packs[i].header[3];
+    if (seq >= r->packets || F_length != ((r->size - seq*kk < kk) ? r->size - seq*kk : kk))
+    {
+        atomic_fetch_add_explicit(&(r->invalid), 1, memory_order_relaxed);
+        return -1;
+    }
 
-    /*
-     * It might not be as straightforward to unpack a transfer frame
-     * after it has been received, since the size (in # of packets) needs
-     * to be transmitted to the receiver alongside the message.
-     */
+    // Claim the packet before copying, so that a duplicate never writes over it
+    bit = 1u << (seq % 32);
+    if (atomic_fetch_or_explicit(&(r->received[seq / 32]), bit, memory_order_relaxed) & bit)
+    {
+        atomic_fetch_add_explicit(&(r->duplicates), 1, memory_order_relaxed);
+        return -1;
+    }
 
-    MSG_TYPE * msg = malloc(N * sizeof(MSG_TYPE));
+    memcpy(&(r->msg[seq*kk]), data, F_length * sizeof(MSG_TYPE));
+    atomic_fetch_add_explicit(&(r->placed), 1, memory_order_release);
 
-    // Loop over data in all packets to form single message array
-    for (i = 0; i<transfer->size; i++)
-        for (j = 0; j<transfer->packs[i].header[3]; j++)
-            msg[j + i*kk] = transfer->packs[i].data[j];
+    return 0;
+}
 
+// reassembly_place_seq() of the (decoded) data of a packet with the given header
+static inline int reassembly_place(reassembly_t * r, const MSG_TYPE * header, const MSG_TYPE * data)
+{
+    return reassembly_place_seq(r, header_seq(header), header[3], data);
+}
+
+// 1 once every packet of the message has been placed; the whole message can then be read
+static inline int reassembly_complete(reassembly_t * r)
+{
+    return atomic_load_explicit(&(r->placed), memory_order_acquire) == r->packets;
+}
+
+/*
+ * Store the sequence numbers of the packets not placed (yet) in seq[], which
+ * holds max numbers, in increasing order. Returns the # of packets missing,
+ * which may be more than max.
+ */
+static inline int reassembly_missing(reassembly_t * r, int * seq, int max)
+{
+    register int i;
+    int missing = 0;
+    unsigned int word = 0;
+
+    for (i = 0; i < r->packets; i++)
+    {
+        if (i % 32 == 0)
+            word = atomic_load_explicit(&(r->received[i / 32]), memory_order_relaxed);
+
+        if (!(word & (1u << (i % 32))))
+        {
+            if (missing < max) seq[missing] = i;
+            missing++;
+        }
+    }
 
-    return msg;
+    return missing;
 }
 
 // Print transfer
-void print_transfer(transfer_t * transfer)
+static inline void print_transfer(transfer_t * transfer)
 {
     register int i,j;
 
@@ -198,7 +555,8 @@ void print_transfer(transfer_t * transfer)
     for (j = 0; j < kk; j++) {
         printf("data[%i] \t\t\t", j);
         for (i = 0; i < transfer->size; i++)
-            printf("%i\t\t\t", packs[i].data[j]);
+            if (j < packs[i].header[3]) printf("%i\t\t\t", packs[i].data[j]);
+            else printf("-\t\t\t"); // Not part of a short frame
 
         printf("\n");
     }